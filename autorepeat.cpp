@@ -0,0 +1,136 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file autorepeat.cpp
+ * @brief Tick timed key repeat with an acceleration curve
+ */
+
+#include "autorepeat.h"
+
+#ifdef REPEAT_ACCEL
+
+#include <util/atomic.h>
+#include <PS2KeyAdvanced.h>
+#include "keybuffer.h"
+#include "output.h"
+#include "stats.h"
+#include "tick.h"
+#include "typematic.h"
+
+// code of the held key, 0 for none
+static uint16_t heldCode = 0;
+// ticks the key has been repeating, for the curve
+static uint32_t repeatingTicks;
+
+// ticks to the next repeat and the interval after it, 0 when stopped
+static volatile uint16_t countdown = 0;
+static volatile uint16_t period;
+static volatile bool due = false;
+
+void repeatBegin() {
+  tickBegin();
+}
+
+void repeatTick() {
+  if (countdown && --countdown == 0) {
+    due = true;
+    countdown = period;
+  }
+}
+
+/**
+ * @return Ticks between repeats after the key has repeated for the
+ *         given time: the start rate plus the acceleration, up to the
+ *         capacity of the line
+ */
+static uint16_t periodAfter(uint32_t ticks) {
+  uint32_t cps = repeatCps + ticks * REPEAT_ACCEL_CPS / TICK_HZ;
+  uint8_t ceiling = wireCapacityCps();
+  if (cps > ceiling) {
+    cps = ceiling;
+  }
+  if (cps > stats.repeatPeakCps) {
+    stats.repeatPeakCps = cps;
+  }
+  return TICK_HZ / cps;
+}
+
+static void stop() {
+  heldCode = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    countdown = 0;
+    due = false;
+  }
+}
+
+bool repeatFilter(uint16_t code) {
+  uint8_t key = code & 0xFF;
+  if (code & PS2_BREAK) {
+    if (heldCode && key == (heldCode & 0xFF)) {
+      stop();
+    }
+    return false;
+  }
+  // modifiers and locks come below Esc
+  if (key < PS2_KEY_ESC) {
+    return true;
+  }
+  if (code == heldCode) {
+    // the keyboard's own repeat
+    return false;
+  }
+  // the last key pressed repeats
+  heldCode = code;
+  repeatingTicks = 0;
+  uint16_t delayTicks = (uint32_t)(repeatDelay + 1) * 250 * TICK_HZ / 1000;
+  uint16_t first = periodAfter(0);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    period = first;
+    countdown = delayTicks;
+    due = false;
+  }
+  return true;
+}
+
+bool repeatRead(uint16_t* code) {
+  if (!due) {
+    return false;
+  }
+  uint16_t interval;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    due = false;
+    interval = period;
+  }
+  // the previous key is not out yet: skip, and do not speed up further
+  if (keyBufferCount() > 0 || frameQueueFree() < FRAME_QUEUE_SIZE) {
+    stats.repeatSkipped++;
+    return false;
+  }
+  repeatingTicks += interval;
+  uint16_t next = periodAfter(repeatingTicks);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    period = next;
+  }
+  *code = heldCode;
+  return true;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file autorepeat.h
+ * @brief Accelerating key repeat generated by the adapter
+ *
+ * With REPEAT_ACCEL, keys repeat at repeatCps after repeatDelay and get
+ * faster the longer they are held, by REPEAT_ACCEL_CPS characters per
+ * second for every second. The rate never goes above what the MBC line
+ * carries with the current frame format and gap (wireCapacityCps()),
+ * and a repeat that falls due while keys or frames are still waiting
+ * is skipped, so holding a key never builds a backlog.
+ *
+ * The keyboard's own repeats are dropped; it is set to its slowest rate
+ * and has to report releases, see repeatFilter(). The repeats are timed
+ * by the Timer2 tick (see tick.h), the main loop only picks them up.
+ * Modifiers and lock keys do not repeat.
+ */
+
+#ifndef AUTOREPEAT_H
+#define AUTOREPEAT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef REPEAT_ACCEL
+
+/**
+ * @brief Start the tick
+ */
+void repeatBegin();
+
+/**
+ * @brief Follow presses and releases coming from the keyboard
+ *
+ * @param code Code as delivered by PS2KeyAdvanced, PS2_BREAK for a release
+ * @return false if the code is a release or a repeat of the keyboard's
+ *         own and is not to be translated
+ */
+bool repeatFilter(uint16_t code);
+
+/**
+ * @brief Take the repeat of the held key, if one is due
+ *
+ * @return false if no repeat is due or it has been skipped
+ */
+bool repeatRead(uint16_t* code);
+
+/**
+ * @brief Count down to the next repeat. Called by the Timer2 interrupt.
+ */
+void repeatTick();
+
+#endif
+
+#endif
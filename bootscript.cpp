@@ -0,0 +1,131 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file bootscript.cpp
+ * @brief Boot scripts of the key mapping profiles and their task
+ */
+
+#include "bootscript.h"
+
+#ifdef BOOT_SCRIPT
+
+#include "output.h"
+#include "profiles.h"
+#include "stats.h"
+#include "tasks.h"
+
+struct BootStep {
+  uint32_t at;       // milliseconds after the reset
+  const void* data;  // SeqFrame sequence or text, in PROGMEM
+  uint8_t length;    // frames or characters
+  uint8_t flags;     // BOOT_STEP_TEXT
+};
+
+// data is text, sent with even parity
+#define BOOT_STEP_TEXT 0x01
+
+#define BOOT_SEQ(ms, seq) \
+  { ms, seq, sizeof(seq) / sizeof(SeqFrame), 0 }
+#define BOOT_TEXT(ms, text) \
+  { ms, text, sizeof(text) - 1, BOOT_STEP_TEXT }
+
+struct BootScript {
+  const BootStep* steps;  // in PROGMEM
+  uint8_t count;
+};
+
+// ---------------------------------------------------
+// Scripts, adjust the times to the machine and its boot disk
+// ---------------------------------------------------
+// MS-DOS date and time prompts, keep the current values
+static const SeqFrame bootReturn[] PROGMEM = { SEQ_KEY(0x0d) };
+static const char bootWordStar[] PROGMEM = "WS\r";
+
+static const BootStep plainSteps[] PROGMEM = {
+  BOOT_SEQ(12000, bootReturn),
+  BOOT_SEQ(13000, bootReturn),
+};
+
+static const BootStep wordStarSteps[] PROGMEM = {
+  BOOT_SEQ(12000, bootReturn),
+  BOOT_SEQ(13000, bootReturn),
+  BOOT_TEXT(15000, bootWordStar),
+};
+
+static const BootScript bootScripts[PROFILE_COUNT] PROGMEM = {
+  { plainSteps, sizeof(plainSteps) / sizeof(BootStep) },
+  { wordStarSteps, sizeof(wordStarSteps) / sizeof(BootStep) },
+};
+
+// script being played, its next step and the time of the reset
+static const BootStep* step;
+static uint8_t stepsLeft;
+static unsigned long resetAt;
+static uint16_t textTicket;
+
+void bootScriptStart() {
+  step = (const BootStep*)pgm_read_ptr(&bootScripts[profileActive()].steps);
+  stepsLeft = pgm_read_byte(&bootScripts[profileActive()].count);
+  resetAt = millis();
+  stats.bootSteps = 0;
+  stats.bootLateMax = 0;
+  taskStart(TASK_BOOT);
+}
+
+bool bootScriptBusy() {
+  return taskRunning(TASK_BOOT);
+}
+
+/**
+ * @brief Queue the frames of the current step
+ *
+ * @return false if the output has no room for them yet
+ */
+static bool sendStep() {
+  const void* data = pgm_read_ptr(&step->data);
+  uint8_t length = pgm_read_byte(&step->length);
+  if (pgm_read_byte(&step->flags) & BOOT_STEP_TEXT) {
+    return mbcSubmit(LANE_HIGH, (const uint8_t*)data, length, JOB_PROGMEM, &textTicket);
+  }
+  return mbcEnqueueSequence((const SeqFrame*)data, length, 0, 0);
+}
+
+void bootTask(Task* t) {
+  TASK_BEGIN(t);
+  while (stepsLeft > 0) {
+    TASK_WAIT_UNTIL(t, millis() - resetAt >= pgm_read_dword(&step->at));
+    TASK_WAIT_UNTIL(t, sendStep());
+
+    // how much later than planned the step was queued
+    {
+      uint32_t late = millis() - resetAt - pgm_read_dword(&step->at);
+      if (late > stats.bootLateMax) {
+        stats.bootLateMax = late > 0xFFFF ? 0xFFFF : late;
+      }
+    }
+    stats.bootSteps++;
+    step++;
+    stepsLeft--;
+  }
+  TASK_END(t);
+}
+
+#endif
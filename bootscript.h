@@ -0,0 +1,61 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file bootscript.h
+ * @brief Keys played into the MBC at fixed times after a reset
+ *
+ * After CTRL-ALT-DEL, MS-DOS asks for the date and time, and some boot
+ * disks offer a menu. A boot script answers these prompts: each step
+ * sends its frames at a fixed time after the reset line was released.
+ * The times are measured from the reset, not from the previous step,
+ * so a step that had to wait for the output does not delay the ones
+ * after it. Every key mapping profile has its own script, see
+ * bootScripts in bootscript.cpp.
+ *
+ * The script runs as a task; keys typed meanwhile are sent as usual. A
+ * new reset starts the script over. With MBC_SENSE, frames are held
+ * until MBC_BOOT_DELAY_MS after the reset, keep the first step later
+ * than that.
+ */
+
+#ifndef BOOTSCRIPT_H
+#define BOOTSCRIPT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef BOOT_SCRIPT
+
+/**
+ * @brief Start the script of the active profile
+ *
+ * Call when the reset line is released; the step times count from here.
+ */
+void bootScriptStart();
+
+/**
+ * @return true while a boot script is running
+ */
+bool bootScriptBusy();
+
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file config.h
+ * @brief Build configuration for the Sanyo MBC keyboard adapter
+ *
+ * Pin assignments, serial parameters, buffer sizes and the optional
+ * feature switches live here so that every module of the sketch sees
+ * the same configuration.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+
+// You can activate debug mode that outputs to the serial console
+// For debugging and plugging the arduino directly into a
+// computer's usb/serial. Don't enable in final firmare.
+// #define DEBUG 1 // detail keystroke and program info
+// #define OUTPUT_DEBUG 1 // just outputs the final hex characters readable
+// #define SELF_TEST 1 // compares the key translation against the original one at startup
+
+// Reduced-footprint build of the core. It needs Timer2 in CTC mode and
+// the input capture pin ICP1 (pin 8), so it only builds for the
+// ATmega88, 168 and 328; its size has not been measured, a fit into the
+// ATmega88's 8 KB of flash is not established. Only the input capture
+// PS/2 receiver, the translation tables, key mapping profiles and the
+// MBC line on a software uart are kept.
+// Serial is never touched, so neither its code nor its buffers are
+// linked. No counters printout or task benchmark, and small
+// buffers (see Buffering). Wire the MBC to the usual TX pin.
+// #define TINY 1
+
+#ifdef TINY
+#define PS2_CAPTURE 1
+#endif
+
+// The Mega 2560 drives the MBC from its second uart (TX1, pin 18), so
+// the serial port on USB stays free for the host link and debug output,
+// and a sketch can be uploaded while the MBC is connected. Selected
+// automatically when building for the Mega; the buffers are larger.
+#if defined(__AVR_ATmega2560__)
+#define MEGA 1
+#endif
+
+// Receive the keyboard with Timer1's input capture instead of
+// PS2KeyAdvanced: every clock edge is timestamped, glitches are rejected
+// and error rates are counted. Needs different wiring, see below.
+// #define PS2_CAPTURE 1
+
+// Wire the TX pin (1) back to pin 8 (ICP1) and measure every frame on
+// the MBC line with Timer1: bit timing, parity, stop bits and gaps, see
+// loopback.h. The PS/2 data pin moves to pin 4.
+// #define TX_LOOPBACK 1
+
+#ifdef PS2_CAPTURE
+// ps2 adapter pins for the input capture receiver
+const int KB_DATAPIN = 4;  // ps2 data pin
+const int KB_IRQPIN = 8;   // ps2 clock pin. has to be on 8 (ICP1)
+#define KB_DATA_PINREG PIND  // port register and bit of KB_DATAPIN
+#define KB_DATA_BIT PD4
+#elif defined(TX_LOOPBACK)
+// ps2 adapter pins, pin 8 is taken by the loopback
+const int KB_DATAPIN = 4;  // ps2 data pin
+const int KB_IRQPIN = 3;   // ps2 clock pin. has to be on 2 or 3 (interrupt pin)
+#else
+// ps2 adapter pins
+const int KB_DATAPIN = 8;  // ps2 data pin
+const int KB_IRQPIN = 3;   // ps2 clxock pin. has to be on 2 or 3 (interrupt pin)
+#endif
+
+// Scan a key matrix of switches instead of reading a PS/2 keyboard, for
+// replacement keyboards; see matrix.h. Rows are driven low one by one,
+// the columns are read from one port. Uses Timer2.
+// #define MATRIX 1
+#define MATRIX_ROWS 9
+#define MATRIX_ROW_PINS 2, 3, 4, 8, 9, 10, 11, 12, 13
+#define MATRIX_COL_PINREG PINC  // columns on A0-A5
+#define MATRIX_COL_PORT PORTC
+#define MATRIX_COL_DDR DDRC
+#define MATRIX_COL_MASK 0x3F
+
+// serial configuration as per MBC-555 specifications
+const int MBC_BAUD = 1200;          // 1200 baud
+const int MBC_SR_CFG = SERIAL_8E2;  // 8 data, 2 stop bits
+const int MBC_SR_CFG_CTRL = SERIAL_8O2;  // parity error, used for CTRL codes
+
+// uart driving the MBC and its registers
+#ifdef MEGA
+#define MBC_SERIAL Serial1
+#define MBC_UCSRA UCSR1A
+#define MBC_UCSRC UCSR1C
+#define MBC_UDR UDR1
+#define MBC_TXC TXC1
+#define MBC_U2X U2X1
+#define MBC_MPCM MPCM1
+#else
+#define MBC_SERIAL Serial
+#define MBC_UCSRA UCSR0A
+#define MBC_UCSRC UCSR0C
+#define MBC_UDR UDR0
+#define MBC_TXC TXC0
+#define MBC_U2X U2X0
+#define MBC_MPCM MPCM0
+#endif
+
+// output pin for reset
+const int MBC_RESET_PIN = 6;  // reset pin to MBC; pulled to low for reset
+
+// Sense whether the MBC is powered and out of reset, and hold the output
+// while it is not. Wire the connector's VCC (o3) to MBC_POWER_PIN and the
+// reset line (o5) to MBC_RESET_SENSE_PIN, each through a 10k resistor.
+// #define MBC_SENSE 1
+const int MBC_POWER_PIN = 7;        // VCC of the MBC keyboard connector
+const int MBC_RESET_SENSE_PIN = 5;  // reset line, low while in reset
+#define MBC_BOOT_DELAY_MS 5000      // time the MBC needs after power-up/reset
+
+// Keep settings and other user data in a reserved flash area that the
+// firmware writes itself through optiboot's do_spm. Needs optiboot 8 or
+// later, e.g. the Nano's "new bootloader". See flashstore.h.
+// #define FLASH_STORE 1
+#define FLASH_STORE_SIZE 4096     // bytes, a multiple of the flash page size
+#define FLASH_RECORD_MAX 32       // largest record payload in bytes
+#define FLASH_WRITE_QUIET_MS 100  // keyboard quiet time before a page write
+#define FLASH_COMPACT_MAX 32      // bytes of other records kept when a full store is rewritten
+#define SETTINGS_SAVE_DELAY_MS 5000  // no changes for this long before settings are saved
+
+// Talk to a host program over the Arduino's USB serial port instead of
+// driving the MBC: settings, text pasted into the output, counters. The
+// frames for the MBC are reported to the host. See hostlink.h.
+// #define HOST_LINK 1
+#define HOST_PACKET_SIZE 64  // largest packet, decoded, including header and crc
+#ifdef MEGA
+#define HOST_BAUD 250000     // exact at 16 MHz
+#define HOST_RX_BUFFERS 6    // receive buffers, one less is the credit for DATA
+#else
+#define HOST_BAUD 115200
+#define HOST_RX_BUFFERS 3    // receive buffers, one less is the credit for DATA
+#endif
+
+// Send the frames for the MBC from the Timer2 interrupt, fed by a small
+// lock-free ring, instead of from the main loop, see txring.h.
+// #define TX_RING 1
+#define TX_RING_SIZE 2  // frames handed over ahead of the wire (power of two)
+
+// Record keys and frames into a compact trace in RAM, see trace.h. The
+// host link dumps it.
+// #define TRACE 1
+#ifdef MEGA
+#define TRACE_BUFFER_SIZE 2048   // bytes (power of two)
+#define TRACE_SYNC_INTERVAL 256  // bytes between sync points
+#else
+#define TRACE_BUFFER_SIZE 256   // bytes (power of two)
+#define TRACE_SYNC_INTERVAL 32  // bytes between sync points
+#endif
+
+// Play a recorded trace (see trace.h) into the MBC with its original
+// timing and compare the frames produced with the recorded ones, see
+// replay.h. CTRL-ALT-T plays the trace in replaytrace.h; with HOST_LINK
+// traces can be uploaded into RAM as well. Uses Timer2.
+// #define REPLAY 1
+#ifdef MEGA
+#define REPLAY_BUFFER_SIZE 2048  // bytes for an uploaded trace
+#else
+#define REPLAY_BUFFER_SIZE 192  // bytes for an uploaded trace
+#endif
+
+// ---------------------------------------------------
+// Buffering
+// ---------------------------------------------------
+// PS2KeyAdvanced only keeps a handful of keys (_KEY_BUFF_SIZE in the
+// library). Barcode wedges and other keyboard emulators send much faster
+// than the MBC line can take them, so keys are moved into a large RAM
+// buffer right away and released at the pace of the serial line.
+#define PS2_LIB_BUFFER_SIZE 16  // size of the library's internal key buffer
+#ifdef TINY
+#define KEY_BUFFER_SIZE 16      // burst buffer in key codes (power of two)
+#define FRAME_QUEUE_SIZE 8      // frames waiting for the wire (power of two)
+#define JOB_QUEUE_SIZE 1        // injected jobs per lane (power of two)
+#elif defined(MEGA)
+#define KEY_BUFFER_SIZE 128     // burst buffer in key codes (power of two)
+#define FRAME_QUEUE_SIZE 128    // frames waiting for the wire (power of two)
+#define JOB_QUEUE_SIZE 16       // injected jobs per lane (power of two)
+#else
+#define KEY_BUFFER_SIZE 128     // burst buffer in key codes (power of two)
+#define FRAME_QUEUE_SIZE 32     // frames waiting for the wire (power of two)
+#define JOB_QUEUE_SIZE 4        // injected jobs per lane (power of two)
+#endif
+#define TEXT_BUFFER_SIZE 64     // line buffer for text typed into the MBC
+
+// key repeat programmed into the keyboard, see typematic.h. The rate is
+// capped by what the serial line can carry.
+#define REPEAT_CPS 20   // characters per second
+#define REPEAT_DELAY 1  // 0-3, i.e. 250, 500, 750 or 1000ms
+
+// Repeat keys on the adapter instead of the keyboard, starting at
+// REPEAT_CPS and getting faster while the key is held, up to what the
+// line carries; see autorepeat.h. Uses Timer2.
+// #define REPEAT_ACCEL 1
+#define REPEAT_ACCEL_CPS 10  // characters per second gained per second held
+
+// Drive several MBCs from one keyboard: target 0 is the serial port,
+// each further target a software uart on one of MBC_SOFT_TX_PINS (Timer2,
+// so not together with MATRIX). Each target has its own queues, so with
+// 3 targets FRAME_QUEUE_SIZE 16 keeps the RAM use about the same.
+#define MBC_TARGETS 1
+#define MBC_SOFT_TX_PINS 9, 10
+
+// targets driven by a software uart; TINY drives the first one that way too
+#ifdef TINY
+#define SOFT_UARTS MBC_TARGETS
+#define MBC_TX_PIN 1  // the uart's TX pin, used as a plain output
+#else
+#define SOFT_UARTS (MBC_TARGETS - 1)
+#endif
+
+// Edit command lines on the adapter and send them on RETURN, with a
+// history of previous lines, see lineedit.h. CTRL-ALT-L turns it on.
+// Takes about (LINE_EDIT_LENGTH + 4) * (LINE_HISTORY + 1) bytes of RAM.
+// #define LINE_EDIT 1
+#define LINE_EDIT_LENGTH 64  // longest line, MS-DOS takes 127
+#ifdef MEGA
+#define LINE_HISTORY 16      // lines kept for recall
+#else
+#define LINE_HISTORY 4       // lines kept for recall
+#endif
+
+// key mapping profile active after power-up, see profiles.h
+#define DEFAULT_PROFILE 0
+
+// Answer the boot prompts after CTRL-ALT-DEL with the boot script of the
+// active profile, timed from the reset, see bootscript.h.
+// #define BOOT_SCRIPT 1
+
+// Only one frame is ever handed to the uart at a time: the next one is
+// released once the estimated transmit time of the previous frame has
+// passed and the uart reports it as sent. That keeps the uart backlog at
+// zero, so a parity switch always lands right behind the frame before it.
+const unsigned long MBC_FRAME_BITS = 12;  // start, 8 data, parity, 2 stop bits
+const unsigned long MBC_FRAME_US = MBC_FRAME_BITS * 1000000UL / MBC_BAUD;
+// additional idle time between frames, breathing room for the BIOS
+#define MBC_FRAME_GAP_US 5000
+
+#if defined(TX_LOOPBACK) && (defined(PS2_CAPTURE) || defined(MATRIX))
+#error "TX_LOOPBACK needs Timer1 and pin 8, which PS2_CAPTURE and MATRIX use"
+#endif
+#if defined(TX_LOOPBACK) && (defined(HOST_LINK) || defined(OUTPUT_DEBUG) || defined(DEBUG))
+#error "TX_LOOPBACK measures MBC frames, the serial port carries other data"
+#endif
+
+#if defined(TINY) && (defined(DEBUG) || defined(OUTPUT_DEBUG) || defined(SELF_TEST) || \
+    defined(HOST_LINK) || defined(TX_LOOPBACK) || defined(TX_RING))
+#error "TINY has no serial port for debug output, the host link or the uart based options"
+#endif
+#if defined(TINY) && (defined(MATRIX) || defined(FLASH_STORE) || defined(TRACE) || \
+    defined(LINE_EDIT) || defined(REPLAY) || defined(BOOT_SCRIPT) || defined(REPEAT_ACCEL) || \
+    MBC_TARGETS > 1)
+#error "TINY only keeps the core of the adapter"
+#endif
+#if defined(TINY) && !(defined(__AVR_ATmega88__) || defined(__AVR_ATmega88A__) || \
+    defined(__AVR_ATmega88P__) || defined(__AVR_ATmega88PA__) || defined(__AVR_ATmega88PB__) || \
+    defined(__AVR_ATmega168__) || defined(__AVR_ATmega168A__) || defined(__AVR_ATmega168P__) || \
+    defined(__AVR_ATmega168PA__) || defined(__AVR_ATmega168PB__) || defined(__AVR_ATmega328__) || \
+    defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328PB__))
+#error "TINY needs Timer2 and ICP1 of an ATmega88, 168 or 328"
+#endif
+
+#if defined(TX_RING) && !defined(MEGA) && (defined(HOST_LINK) || defined(OUTPUT_DEBUG))
+#error "TX_RING drives the uart for the MBC, the serial port carries other data"
+#endif
+
+#if defined(MEGA) && (defined(TINY) || defined(PS2_CAPTURE) || defined(TX_LOOPBACK) || defined(MATRIX))
+#error "The Mega has no Timer1 input capture and no port C on the pins of these options"
+#endif
+#if defined(MEGA) && (defined(MBC_SENSE) || defined(FLASH_STORE))
+#error "The Mega has no pin change interrupt on the sense pins and no optiboot"
+#endif
+
+#if defined(MATRIX) && MBC_TARGETS > 1
+#error "MATRIX uses the pins of the additional MBC targets"
+#endif
+
+// keystroke to wire latency histogram, bucket n counts latencies
+// below 2^n milliseconds
+#define LATENCY_BUCKETS 12
+
+#endif
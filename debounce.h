@@ -0,0 +1,61 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file debounce.h
+ * @brief Vertical counter debounce of eight switches at once
+ *
+ * Each switch has a two bit counter, its bits spread over two bytes so
+ * that one row of eight switches is debounced with a few byte
+ * operations. The counter counts samples that differ from the debounced
+ * state; any equal sample clears it. Once it wraps after 4 samples the
+ * state of that switch flips.
+ *
+ * Only needs <stdint.h>, so the host tests in tests/ can use it.
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdint.h>
+
+struct DebounceRow {
+  uint8_t state;   // debounced state, one bit per switch
+  uint8_t count0;  // low bits of the counters
+  uint8_t count1;  // high bits of the counters
+};
+
+/**
+ * @brief Feed one sample of eight switches
+ *
+ * @param row Debounce state of the switches
+ * @param sample One bit per switch, set while it is closed
+ * @return Switches whose debounced state flipped with this sample
+ */
+static inline uint8_t debounceRow(DebounceRow& row, uint8_t sample) {
+  uint8_t delta = sample ^ row.state;
+  row.count1 = (row.count1 ^ row.count0) & delta;
+  row.count0 = ~row.count0 & delta;
+  uint8_t toggle = delta & ~(row.count0 | row.count1);
+  row.state ^= toggle;
+  return toggle;
+}
+
+#endif
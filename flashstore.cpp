@@ -0,0 +1,312 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file flashstore.cpp
+ * @brief Append-only record log in flash, programmed through optiboot
+ */
+
+#include "flashstore.h"
+
+#ifdef FLASH_STORE
+
+#include <avr/boot.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include "keybuffer.h"
+#include "output.h"
+#include "stats.h"
+#include "tasks.h"
+
+#if FLASH_STORE_SIZE % SPM_PAGESIZE != 0
+#error FLASH_STORE_SIZE must be a multiple of SPM_PAGESIZE
+#endif
+#if 2 + FLASH_COMPACT_MAX + FLASH_RECORD_MAX + 4 > SPM_PAGESIZE
+#error The magic, FLASH_COMPACT_MAX and a new record must fit the first page
+#endif
+
+// optiboot 8 exports do_spm right behind its first instruction, and its
+// version in the last word of the flash
+typedef void (*DoSpm)(uint16_t address, uint8_t command, uint16_t data);
+static const DoSpm doSpm = (DoSpm)((FLASHEND - 511 + 2) >> 1);
+#define OPTIBOOT_VERSION_ADDR (FLASHEND - 1)
+#define OPTIBOOT_MIN_MAJOR 8
+
+// the area starts with a magic, the log follows
+#define FLASH_MAGIC_0 'F'
+#define FLASH_MAGIC_1 'S'
+#define FLASH_LOG_START 2
+#define FLASH_RECORD_OVERHEAD 4  // type, length, crc
+
+// the compiler fills the area with zeros, flashStoreBegin() formats it
+static const uint8_t flashArea[FLASH_STORE_SIZE] PROGMEM __attribute__((aligned(SPM_PAGESIZE))) = {0};
+
+// byte address of the area, for do_spm
+#define FLASH_AREA_ADDR ((uint16_t)(uintptr_t)flashArea)
+
+static bool writable = false;
+// offset of the free space behind the log
+static uint16_t logEnd = FLASH_STORE_SIZE;
+
+// record being appended, written page by page by the task; while
+// compacting, the magic, the records kept and the new one
+static uint8_t pending[FLASH_LOG_START + FLASH_COMPACT_MAX + FLASH_RECORD_MAX + FLASH_RECORD_OVERHEAD];
+static uint8_t pendingLength = 0;
+static uint8_t pendingDone = 0;
+// pages left to erase while formatting
+static uint8_t formatPages = 0;
+
+static uint8_t flashRead(uint16_t offset) {
+  return pgm_read_byte(&flashArea[offset]);
+}
+
+static uint16_t recordCrc(uint16_t offset, uint8_t length) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < length + 2; i++) {
+    crc = _crc_ccitt_update(crc, flashRead(offset + i));
+  }
+  return crc;
+}
+
+/**
+ * @brief Run one page operation with the keyboard inhibited
+ *
+ * Holding the clock low for 100us makes the keyboard abort and later
+ * repeat a byte it had started to send. The edge we cause ourselves is
+ * cleared from the receiver's interrupt flag before releasing it. A key
+ * matrix just misses a few scans.
+ */
+static void pageOperation(uint16_t address, uint8_t command) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+#ifdef MATRIX
+    doSpm(address, command, 0);
+#else
+    digitalWrite(KB_IRQPIN, LOW);
+    pinMode(KB_IRQPIN, OUTPUT);
+    delayMicroseconds(100);
+
+    doSpm(address, command, 0);
+
+    pinMode(KB_IRQPIN, INPUT_PULLUP);
+    delayMicroseconds(10);
+#ifdef PS2_CAPTURE
+    TIFR1 = _BV(ICF1);
+#else
+    EIFR = _BV(digitalPinToInterrupt(KB_IRQPIN));
+#endif
+#endif
+  }
+  stats.flashPageOps++;
+}
+
+/**
+ * @brief Program the bytes of the pending record that fall into one page
+ *
+ * Bytes outside the record are filled with 0xFF, which leaves the flash
+ * as it is, so the page is written without erasing it first.
+ */
+static void writePendingPage() {
+  uint16_t start = logEnd + pendingDone;
+  uint16_t page = start & ~(uint16_t)(SPM_PAGESIZE - 1);
+  uint16_t end = logEnd + pendingLength;
+  if (end > page + SPM_PAGESIZE) {
+    end = page + SPM_PAGESIZE;
+  }
+  uint16_t base = FLASH_AREA_ADDR;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint16_t i = page; i < page + SPM_PAGESIZE; i += 2) {
+      uint8_t low = (i >= start && i < end) ? pending[i - logEnd] : 0xFF;
+      uint8_t high = (i + 1 >= start && i + 1 < end) ? pending[i + 1 - logEnd] : 0xFF;
+      doSpm(base + i, __BOOT_PAGE_FILL, low | (high << 8));
+    }
+  }
+  pageOperation(base + page, __BOOT_PAGE_WRITE);
+  pendingDone += end - start;
+}
+
+static bool flashQuiet() {
+  return keyBufferCount() == 0 && keyQuietMs() >= FLASH_WRITE_QUIET_MS && outputIdle();
+}
+
+void flashTask(Task* t) {
+  TASK_BEGIN(t);
+
+  // the first page last, until then it keeps the magic and its records
+  while (formatPages > 1) {
+    TASK_WAIT_UNTIL(t, flashQuiet());
+    formatPages--;
+    pageOperation(FLASH_AREA_ADDR + formatPages * SPM_PAGESIZE, __BOOT_PAGE_ERASE);
+  }
+  if (formatPages > 0) {
+    TASK_WAIT_UNTIL(t, flashQuiet());
+    formatPages = 0;
+    // the new log fits the first page, written right behind the erase
+    pageOperation(FLASH_AREA_ADDR, __BOOT_PAGE_ERASE);
+    writePendingPage();
+  }
+
+  while (pendingDone < pendingLength) {
+    TASK_WAIT_UNTIL(t, flashQuiet());
+    writePendingPage();
+  }
+  logEnd += pendingLength;
+  pendingLength = 0;
+  pendingDone = 0;
+
+  TASK_END(t);
+}
+
+void flashStoreBegin() {
+  writable = (pgm_read_word(OPTIBOOT_VERSION_ADDR) >> 8) >= OPTIBOOT_MIN_MAJOR;
+
+  if (flashRead(0) != FLASH_MAGIC_0 || flashRead(1) != FLASH_MAGIC_1) {
+    if (writable) {
+      // erase all pages, then append the magic as the first "record"
+      formatPages = FLASH_STORE_SIZE / SPM_PAGESIZE;
+      logEnd = 0;
+      pending[0] = FLASH_MAGIC_0;
+      pending[1] = FLASH_MAGIC_1;
+      pendingLength = FLASH_LOG_START;
+      pendingDone = 0;
+      taskStart(TASK_FLASH);
+    }
+    return;
+  }
+
+  // skip over the records to the free space
+  uint16_t offset = FLASH_LOG_START;
+  while (offset < FLASH_STORE_SIZE && flashRead(offset) != FLASH_REC_FREE) {
+    offset += flashRead(offset + 1) + FLASH_RECORD_OVERHEAD;
+  }
+  logEnd = offset < FLASH_STORE_SIZE ? offset : FLASH_STORE_SIZE;
+}
+
+bool flashStoreWritable() {
+  return writable;
+}
+
+/**
+ * @brief Copy the newest record of each type but one to the pending buffer
+ *
+ * @param skip Type left out, it is about to be superseded
+ * @return Bytes copied behind the magic, or -1 if they do not fit
+ */
+static int16_t gatherNewest(uint8_t skip) {
+  uint8_t used = FLASH_LOG_START;
+  uint16_t offset = 0;
+  FlashRecord record, newest;
+  while (flashStoreNext(&offset, &record)) {
+    if (record.type == skip || !flashStoreFind(record.type, &newest) ||
+        newest.data != record.data) {
+      continue;
+    }
+    uint8_t size = record.length + FLASH_RECORD_OVERHEAD;
+    if (used + size > FLASH_LOG_START + FLASH_COMPACT_MAX) {
+      return -1;
+    }
+    // the stored crc covers type and length too, copy it as it is
+    memcpy_P(&pending[used], record.data - 2, size);
+    used += size;
+  }
+  return used - FLASH_LOG_START;
+}
+
+bool flashStoreAppend(uint8_t type, const void* data, uint8_t length) {
+  if (!writable || taskRunning(TASK_FLASH) || length > FLASH_RECORD_MAX ||
+      type == FLASH_REC_DELETED || type == FLASH_REC_FREE) {
+    return false;
+  }
+  uint8_t at = 0;
+  if (length + FLASH_RECORD_OVERHEAD > flashStoreFree()) {
+    int16_t kept = gatherNewest(type);
+    if (kept < 0) {
+      return false;
+    }
+    // erase the area, then write the magic, the kept records and the new one
+    pending[0] = FLASH_MAGIC_0;
+    pending[1] = FLASH_MAGIC_1;
+    at = FLASH_LOG_START + kept;
+    formatPages = FLASH_STORE_SIZE / SPM_PAGESIZE;
+    logEnd = 0;
+    stats.flashCompactions++;
+  }
+  pending[at] = type;
+  pending[at + 1] = length;
+  memcpy(&pending[at + 2], data, length);
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < length + 2; i++) {
+    crc = _crc_ccitt_update(crc, pending[at + i]);
+  }
+  pending[at + length + 2] = crc & 0xFF;
+  pending[at + length + 3] = crc >> 8;
+  pendingLength = at + length + FLASH_RECORD_OVERHEAD;
+  pendingDone = 0;
+  taskStart(TASK_FLASH);
+  return true;
+}
+
+bool flashStoreBusy() {
+  return taskRunning(TASK_FLASH);
+}
+
+bool flashStoreNext(uint16_t* offset, FlashRecord* record) {
+  if (*offset < FLASH_LOG_START) {
+    *offset = FLASH_LOG_START;
+  }
+  while (*offset < logEnd) {
+    uint16_t at = *offset;
+    uint8_t type = flashRead(at);
+    uint8_t length = flashRead(at + 1);
+    *offset += length + FLASH_RECORD_OVERHEAD;
+    if (*offset > logEnd || type == FLASH_REC_DELETED) {
+      continue;
+    }
+    uint16_t crc = flashRead(at + length + 2) | (flashRead(at + length + 3) << 8);
+    if (recordCrc(at, length) == crc) {
+      record->type = type;
+      record->length = length;
+      record->data = &flashArea[at + 2];
+      return true;
+    }
+    stats.flashCrcErrors++;
+  }
+  return false;
+}
+
+bool flashStoreFind(uint8_t type, FlashRecord* record) {
+  bool found = false;
+  uint16_t offset = 0;
+  FlashRecord next;
+  while (flashStoreNext(&offset, &next)) {
+    if (next.type == type) {
+      *record = next;
+      found = true;
+    }
+  }
+  return found;
+}
+
+uint16_t flashStoreFree() {
+  uint16_t used = logEnd + pendingLength;
+  return used < FLASH_STORE_SIZE ? FLASH_STORE_SIZE - used : 0;
+}
+
+#endif
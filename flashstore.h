@@ -0,0 +1,135 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file flashstore.h
+ * @brief User data kept in a reserved flash area, written at runtime
+ *
+ * The 1 KB EEPROM is too small for macro libraries or several key
+ * mappings, while a good part of the flash is unused. With FLASH_STORE
+ * enabled, FLASH_STORE_SIZE bytes of flash are reserved and written by
+ * the firmware itself through the do_spm entry point of optiboot 8 or
+ * later (the "new bootloader" of the Nano). Code in the application
+ * section cannot program flash on its own.
+ *
+ * The area is an append-only log of records:
+ *
+ *   type | length | payload (length bytes) | crc16 (ccitt, lsb first)
+ *
+ * A type of 0xFF marks the free space behind the last record. A newer
+ * record of the same type supersedes older ones; records with a wrong
+ * CRC (power lost while writing) are skipped. Appends only program bits
+ * that are still erased, so a power loss cannot damage existing records.
+ *
+ * When a record no longer fits, the store is compacted: the newest
+ * record of each other type is copied to RAM, up to FLASH_COMPACT_MAX
+ * bytes of them including their type, length and crc. The pages behind
+ * the first one are erased, then the first page is erased and at once
+ * rewritten with the magic, those records and the new one. Until then a
+ * power loss leaves the records of the first page readable, which may
+ * bring back older settings. Only a power loss in the few milliseconds
+ * between the erase and the write of the first page loses the store's
+ * contents.
+ *
+ * Reading is plain pgm_read_byte() on the record's payload.
+ *
+ * Flash writes stall the CPU for about 4ms per page with interrupts off.
+ * They are done by a task, one page at a time, and only once the
+ * keyboard has been quiet for FLASH_WRITE_QUIET_MS and the output is
+ * idle. During the write the keyboard clock is held low, which makes the
+ * keyboard hold back its next key instead of losing it.
+ *
+ * Uploading the sketch erases the area.
+ */
+
+#ifndef FLASHSTORE_H
+#define FLASHSTORE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef FLASH_STORE
+
+// record types
+#define FLASH_REC_SETTINGS 0x01  // Settings, see the sketch
+#define FLASH_REC_DELETED 0x00   // invalidated record
+#define FLASH_REC_FREE 0xFF      // erased flash, end of the log
+
+struct FlashRecord {
+  uint8_t type;
+  uint8_t length;
+  const uint8_t* data;  // payload in flash
+};
+
+/**
+ * @brief Find the end of the log, format the area if it is not one
+ *
+ * Call from setup().
+ */
+void flashStoreBegin();
+
+/**
+ * @return true if the bootloader can program flash
+ */
+bool flashStoreWritable();
+
+/**
+ * @brief Queue a record to be appended to the log
+ *
+ * The payload is copied, the task writes it once the keyboard is quiet.
+ * A full store is compacted first.
+ *
+ * @param type Record type, not FLASH_REC_DELETED or FLASH_REC_FREE
+ * @param data Payload in RAM
+ * @param length Up to FLASH_RECORD_MAX bytes
+ * @return false if an append is still pending, the record does not fit
+ *         even after compacting or the store is not writable
+ */
+bool flashStoreAppend(uint8_t type, const void* data, uint8_t length);
+
+/**
+ * @return true while records are waiting to be written
+ */
+bool flashStoreBusy();
+
+/**
+ * @brief Walk the valid records of the log
+ *
+ * @param offset Position in the log, start with 0
+ * @param record Receives the next valid record
+ * @return false past the last record
+ */
+bool flashStoreNext(uint16_t* offset, FlashRecord* record);
+
+/**
+ * @brief Find the newest valid record of a type
+ *
+ * @return false if there is none
+ */
+bool flashStoreFind(uint8_t type, FlashRecord* record);
+
+/**
+ * @return Bytes left for records
+ */
+uint16_t flashStoreFree();
+
+#endif
+
+#endif
@@ -0,0 +1,400 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file hostlink.cpp
+ * @brief COBS framed host protocol with in-place decoding
+ */
+
+#include "hostlink.h"
+
+#ifdef HOST_LINK
+
+#include <util/crc16.h>
+#include "output.h"
+#include "profiles.h"
+#include "stats.h"
+#include "typematic.h"
+#include "trace.h"
+#include "replay.h"
+
+#define HOST_HEADER 2  // type and seq
+#define HOST_CRC 2
+#define HOST_BODY_MAX (HOST_PACKET_SIZE - HOST_HEADER - HOST_CRC)
+
+// receive buffers; a DATA packet keeps its buffer until the job is sent
+struct RxBuffer {
+  uint8_t data[HOST_PACKET_SIZE];
+  bool busy;        // holds a DATA packet waiting for the wire
+  uint16_t ticket;  // of the DATA job
+};
+static RxBuffer rxBuffers[HOST_RX_BUFFERS];
+
+// decoder state
+static RxBuffer* rx = NULL;    // buffer being filled, NULL if none free
+static uint8_t rxLength = 0;   // decoded bytes
+static uint8_t rxRemaining = 0;  // bytes left in the current COBS block
+static uint8_t rxCode = 0xFF;  // code of the current COBS block
+static bool rxOverflow = false;
+
+// throughput, bytes per one second window
+static uint16_t windowStart = 0;
+static uint16_t windowBytes = 0;
+// start of the decoding being timed, see hostParseMicros
+static unsigned long parseStart;
+
+/**
+ * Print target writing into the body of a reply packet.
+ */
+class PacketWriter : public Print {
+public:
+  size_t write(uint8_t c) {
+    if (length < HOST_BODY_MAX) {
+      body[length++] = c;
+    }
+    return 1;
+  }
+  using Print::write;
+
+  uint8_t body[HOST_BODY_MAX];
+  uint8_t length = 0;
+};
+
+void hostLinkBegin() {
+  Serial.begin(HOST_BAUD);
+}
+
+static uint16_t crc16(const uint8_t* data, uint8_t length, uint16_t crc = 0xFFFF) {
+  for (uint8_t i = 0; i < length; i++) {
+    crc = _crc_ccitt_update(crc, data[i]);
+  }
+  return crc;
+}
+
+// packet being sent, before encoding
+static uint8_t txPacket[HOST_PACKET_SIZE];
+
+/**
+ * Writes the blocks of a COBS frame from the packet: each block starts
+ * with the distance to the next zero, the zeros themselves are left out.
+ */
+void hostLinkSend(uint8_t type, uint8_t seq, const uint8_t* body, uint8_t length) {
+  if (length > HOST_BODY_MAX) {
+    length = HOST_BODY_MAX;
+  }
+  txPacket[0] = type;
+  txPacket[1] = seq;
+  memcpy(&txPacket[HOST_HEADER], body, length);
+  uint8_t total = HOST_HEADER + length;
+  uint16_t crc = crc16(txPacket, total);
+  txPacket[total++] = crc & 0xFF;
+  txPacket[total++] = crc >> 8;
+
+  // packets are shorter than 254 bytes, a block ends at a zero or the end
+  uint8_t start = 0;
+  while (start <= total) {
+    uint8_t end = start;
+    while (end < total && txPacket[end] != 0) {
+      end++;
+    }
+    Serial.write(end - start + 1);
+    Serial.write(&txPacket[start], end - start);
+    start = end + 1;
+  }
+  Serial.write((uint8_t)0);
+  stats.hostPacketsOut++;
+}
+
+static void nak(uint8_t type, uint8_t seq, uint8_t reason) {
+  uint8_t body[2] = {type, reason};
+  hostLinkSend(HOST_MSG_NAK, seq, body, sizeof(body));
+}
+
+static bool configGet(uint8_t key, uint8_t* value) {
+  switch (key) {
+    case HOST_CFG_REPEAT_CPS:
+      *value = repeatCps;
+      return true;
+    case HOST_CFG_REPEAT_DELAY:
+      *value = repeatDelay;
+      return true;
+    case HOST_CFG_PROFILE:
+      *value = profileActive();
+      return true;
+  }
+  return false;
+}
+
+static bool configSet(uint8_t key, uint8_t value) {
+  switch (key) {
+    case HOST_CFG_REPEAT_CPS:
+      if (value == 0) {
+        return false;
+      }
+      repeatCps = value;
+      break;
+    case HOST_CFG_REPEAT_DELAY:
+      if (value > 3) {
+        return false;
+      }
+      repeatDelay = value;
+      break;
+    case HOST_CFG_PROFILE:
+      if (value >= PROFILE_COUNT) {
+        return false;
+      }
+      profileSelect(value);
+      break;
+    default:
+      return false;
+  }
+  applyTypematic();
+  settingsChanged();
+  return true;
+}
+
+/**
+ * @brief Act on a complete packet with a valid crc
+ *
+ * @return true if the buffer is kept for a DATA job
+ */
+static bool handlePacket(RxBuffer* buffer, uint8_t length) {
+  uint8_t type = buffer->data[0];
+  uint8_t seq = buffer->data[1];
+  uint8_t* body = &buffer->data[HOST_HEADER];
+  uint8_t bodyLength = length - HOST_HEADER - HOST_CRC;
+  uint8_t reply[3];
+
+  switch (type) {
+    case HOST_MSG_PING:
+      reply[0] = HOST_PROTOCOL_VERSION;
+      reply[1] = HOST_RX_BUFFERS - 1;
+      reply[2] = HOST_PACKET_SIZE;
+      hostLinkSend(HOST_MSG_PONG, seq, reply, 3);
+      return false;
+
+    case HOST_MSG_GET:
+    case HOST_MSG_SET:
+      if (bodyLength < (type == HOST_MSG_SET ? 2 : 1)) {
+        nak(type, seq, HOST_NAK_LENGTH);
+        return false;
+      }
+      if (type == HOST_MSG_SET && !configSet(body[0], body[1])) {
+        nak(type, seq, HOST_NAK_RANGE);
+        return false;
+      }
+      reply[0] = body[0];
+      if (!configGet(body[0], &reply[1])) {
+        nak(type, seq, HOST_NAK_UNKNOWN);
+        return false;
+      }
+      hostLinkSend(HOST_MSG_VALUE, seq, reply, 2);
+      return false;
+
+    case HOST_MSG_DATA:
+      if (bodyLength == 0) {
+        nak(type, seq, HOST_NAK_LENGTH);
+        return false;
+      }
+      // the seq stays in the buffer for the credit
+      if (!mbcSubmit(LANE_LOW, body, bodyLength, 0, &buffer->ticket)) {
+        nak(type, seq, HOST_NAK_BUSY);
+        return false;
+      }
+      stats.hostDataBytes += bodyLength;
+      return true;
+
+    case HOST_MSG_STATS: {
+      if (bodyLength < 1) {
+        nak(type, seq, HOST_NAK_LENGTH);
+        return false;
+      }
+      if (body[0] >= statsLineCount()) {
+        nak(type, seq, HOST_NAK_RANGE);
+        return false;
+      }
+      PacketWriter writer;
+      writer.write(body[0]);
+      writer.write(statsLineCount());
+      printStatsLine(writer, body[0]);
+      hostLinkSend(HOST_MSG_STATS_LINE, seq, writer.body, writer.length);
+      return false;
+    }
+
+#ifdef TRACE
+    case HOST_MSG_TRACE: {
+      // from the sync point before the time asked for, or all of it
+      uint32_t time = 0;
+      if (bodyLength >= 4) {
+        memcpy(&time, body, sizeof(time));
+      }
+      uint16_t position = traceSeek(time);
+      uint8_t chunk[HOST_BODY_MAX];
+      uint8_t count;
+      do {
+        count = traceRead(&position, chunk, sizeof(chunk));
+        hostLinkSend(HOST_MSG_TRACE_DATA, seq, chunk, count);
+      } while (count > 0);
+      return false;
+    }
+#endif
+
+#ifdef REPLAY
+    case HOST_MSG_REPLAY: {
+      if (bodyLength < 1) {
+        nak(type, seq, HOST_NAK_LENGTH);
+        return false;
+      }
+      // the buffer is being played from
+      if (replayBusy()) {
+        nak(type, seq, HOST_NAK_BUSY);
+        return false;
+      }
+      uint16_t stored;
+      if (!replayUpload(body + 1, bodyLength - 1, body[0] & HOST_REPLAY_RESTART, &stored)) {
+        nak(type, seq, HOST_NAK_RANGE);
+        return false;
+      }
+      if (body[0] & HOST_REPLAY_PLAY) {
+        replayStartUploaded();
+      }
+      memcpy(reply, &stored, sizeof(stored));
+      hostLinkSend(HOST_MSG_REPLAY_STORED, seq, reply, sizeof(stored));
+      return false;
+    }
+#endif
+  }
+  nak(type, seq, HOST_NAK_UNKNOWN);
+  return false;
+}
+
+static void endPacket() {
+  if (rxOverflow || rxRemaining != 0 || rxLength < HOST_HEADER + HOST_CRC) {
+    // an empty packet between two zeros is just a delimiter
+    if (rxLength > 0 || rxOverflow) {
+      stats.hostFramingErrors++;
+    }
+    return;
+  }
+  uint8_t payload = rxLength - HOST_CRC;
+  uint16_t crc = rx->data[payload] | (rx->data[payload + 1] << 8);
+  if (crc16(rx->data, payload) != crc) {
+    stats.hostCrcErrors++;
+    return;
+  }
+  stats.hostPacketsIn++;
+  // replies wait for room in the serial buffer, that is not parsing
+  stats.hostParseMicros += micros() - parseStart;
+  if (handlePacket(rx, rxLength)) {
+    rx->busy = true;
+    rx = NULL;
+  }
+  parseStart = micros();
+}
+
+static void put(uint8_t b) {
+  if (rxLength < HOST_PACKET_SIZE) {
+    rx->data[rxLength++] = b;
+  } else {
+    rxOverflow = true;
+  }
+}
+
+/**
+ * Decodes one byte into the current buffer. A COBS block code n is
+ * followed by n-1 data bytes and stands for a zero behind them, unless
+ * it is 0xFF or the last block of the packet.
+ */
+static void decode(uint8_t b) {
+  if (b == 0) {
+    endPacket();
+    rxLength = 0;
+    rxRemaining = 0;
+    rxCode = 0xFF;
+    rxOverflow = false;
+    return;
+  }
+  if (rxRemaining == 0) {
+    // a new block, so the previous one ended with a zero
+    if (rxCode != 0xFF) {
+      put(0);
+    }
+    rxCode = b;
+    rxRemaining = b - 1;
+    return;
+  }
+  put(b);
+  rxRemaining--;
+}
+
+/**
+ * @brief Release the buffers of DATA packets that have been sent
+ */
+static void releaseBuffers() {
+  for (uint8_t i = 0; i < HOST_RX_BUFFERS; i++) {
+    RxBuffer& buffer = rxBuffers[i];
+    if (buffer.busy && mbcJobDone(LANE_LOW, buffer.ticket)) {
+      buffer.busy = false;
+      uint8_t credit = 1;
+      hostLinkSend(HOST_MSG_CREDIT, buffer.data[1], &credit, 1);
+    }
+  }
+  if (rx == NULL) {
+    for (uint8_t i = 0; i < HOST_RX_BUFFERS; i++) {
+      if (!rxBuffers[i].busy) {
+        rx = &rxBuffers[i];
+        break;
+      }
+    }
+  }
+}
+
+void hostLinkService() {
+  releaseBuffers();
+  uint16_t now = millis();
+  if ((uint16_t)(now - windowStart) >= 1000) {
+    if (windowBytes > stats.hostRxRate) {
+      stats.hostRxRate = windowBytes;
+    }
+    windowStart = now;
+    windowBytes = 0;
+  }
+
+  // without a free buffer the bytes wait in the serial buffer
+  if (rx == NULL || !Serial.available()) {
+    return;
+  }
+  parseStart = micros();
+  uint8_t count = 0;
+  while (rx != NULL && Serial.available()) {
+    decode(Serial.read());
+    count++;
+  }
+  stats.hostParseMicros += micros() - parseStart;
+  stats.hostRxBytes += count;
+  windowBytes += count;
+}
+
+void hostLinkFrame(uint8_t code, uint8_t flags) {
+  uint8_t body[2] = {code, flags};
+  hostLinkSend(HOST_MSG_FRAME, 0, body, sizeof(body));
+}
+
+#endif
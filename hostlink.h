@@ -0,0 +1,132 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file hostlink.h
+ * @brief Framed binary protocol to a host computer on the USB serial port
+ *
+ * With HOST_LINK enabled, the serial port talks to a host program at
+ * HOST_BAUD instead of driving the MBC. Frames meant for the MBC are
+ * reported to the host, paced as they would be on the real line.
+ *
+ * Packets are COBS encoded and end with a zero byte, so a receiver
+ * always finds the start of the next packet after an error. Decoded, a
+ * packet is
+ *
+ *   type | seq | body | crc16 (ccitt over type, seq and body, lsb first)
+ *
+ * Every request is answered with the same seq, either by its reply or
+ * by HOST_MSG_NAK; a trace dump takes several packets. Bytes are
+ * decoded straight from the serial receive buffer into one of
+ * HOST_RX_BUFFERS packet buffers, and the body of a
+ * HOST_MSG_DATA packet is handed to the output as a job from where it
+ * is, without a copy. The buffer is released once the job has been
+ * sent, which the host learns from a HOST_MSG_CREDIT. HOST_MSG_PING
+ * tells how many DATA packets may be outstanding; one buffer is kept
+ * back for the other requests.
+ */
+
+#ifndef HOSTLINK_H
+#define HOSTLINK_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef HOST_LINK
+
+#if defined(DEBUG) || defined(OUTPUT_DEBUG)
+#error "HOST_LINK needs the serial port, disable DEBUG and OUTPUT_DEBUG"
+#endif
+#if HOST_RX_BUFFERS < 2
+#error "HOST_RX_BUFFERS has to be at least 2"
+#endif
+
+#define HOST_PROTOCOL_VERSION 1
+
+// host to adapter
+#define HOST_MSG_PING 0x01   // -> PONG: version, data credits, packet size
+#define HOST_MSG_GET 0x02    // key -> VALUE: key, value
+#define HOST_MSG_SET 0x03    // key, value -> VALUE: key, new value
+#define HOST_MSG_DATA 0x04   // codes for the MBC -> CREDIT once sent
+#define HOST_MSG_STATS 0x05  // line -> STATS: line, line count, text
+#define HOST_MSG_TRACE 0x06  // [millis] -> TRACE_DATA packets, an empty one last
+#define HOST_MSG_REPLAY 0x07  // flags, trace bytes -> REPLAY_STORED: length (16 bit)
+
+// adapter to host; replies have bit 7 set
+#define HOST_MSG_REPLY 0x80
+#define HOST_MSG_PONG (HOST_MSG_PING | HOST_MSG_REPLY)
+#define HOST_MSG_VALUE (HOST_MSG_GET | HOST_MSG_REPLY)
+#define HOST_MSG_CREDIT (HOST_MSG_DATA | HOST_MSG_REPLY)
+#define HOST_MSG_STATS_LINE (HOST_MSG_STATS | HOST_MSG_REPLY)
+#define HOST_MSG_TRACE_DATA (HOST_MSG_TRACE | HOST_MSG_REPLY)
+#define HOST_MSG_REPLAY_STORED (HOST_MSG_REPLAY | HOST_MSG_REPLY)
+#define HOST_MSG_FRAME 0xF0  // unsolicited: code, flags of an MBC frame
+#define HOST_MSG_NAK 0xFF    // request type, reason
+
+// reasons of a NAK
+#define HOST_NAK_UNKNOWN 1   // unknown type or key
+#define HOST_NAK_LENGTH 2    // body too short
+#define HOST_NAK_BUSY 3      // no credit left, or the output lane is full
+#define HOST_NAK_RANGE 4     // value or line out of range
+
+// flags of REPLAY: a trace is uploaded in several packets, the first
+// one restarts the upload, the last one starts the replay
+#define HOST_REPLAY_RESTART 0x01
+#define HOST_REPLAY_PLAY 0x02
+
+// keys of GET and SET
+#define HOST_CFG_REPEAT_CPS 1
+#define HOST_CFG_REPEAT_DELAY 2
+#define HOST_CFG_PROFILE 3
+
+/**
+ * @brief Open the serial port to the host
+ */
+void hostLinkBegin();
+
+/**
+ * @brief Decode received bytes and answer complete requests
+ *
+ * Call from loop().
+ */
+void hostLinkService();
+
+/**
+ * @brief Report a frame that would have been sent to the MBC
+ */
+void hostLinkFrame(uint8_t code, uint8_t flags);
+
+/**
+ * @brief Send a packet to the host
+ *
+ * @param type HOST_MSG_* type
+ * @param seq Sequence number of the request answered
+ * @param body Body of the packet, in RAM
+ * @param length Length of the body
+ */
+void hostLinkSend(uint8_t type, uint8_t seq, const uint8_t* body, uint8_t length);
+
+// implemented by the sketch, which owns the keyboard and the settings
+void applyTypematic();
+void settingsChanged();
+
+#endif
+
+#endif
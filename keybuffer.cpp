@@ -0,0 +1,81 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file keybuffer.cpp
+ * @brief Burst buffer between the PS/2 library and the translator
+ */
+
+#include "keybuffer.h"
+#include "stats.h"
+#include "trace.h"
+
+// head and tail run freely, the difference is the fill level
+static uint16_t keyBuffer[KEY_BUFFER_SIZE];
+static uint16_t keyStamps[KEY_BUFFER_SIZE];  // arrival time, for latency
+static uint8_t keyHead = 0;
+static uint8_t keyTail = 0;
+
+// last key received, to measure the spacing of repeats
+static uint16_t lastCode = 0;
+static uint16_t lastStamp = 0;
+
+// longer gaps are separate key presses, not repeats
+#define REPEAT_MAX_INTERVAL_MS 1000
+
+bool keyBufferPut(uint16_t code) {
+  uint8_t count = keyHead - keyTail;
+  if (count >= KEY_BUFFER_SIZE) {
+    stats.keysDropped++;
+    return false;
+  }
+  uint16_t now = millis();
+  keyBuffer[keyHead & (KEY_BUFFER_SIZE - 1)] = code;
+  keyStamps[keyHead & (KEY_BUFFER_SIZE - 1)] = now;
+  keyHead++;
+  stats.keysIngested++;
+#ifdef TRACE
+  traceKey(code);
+#endif
+  if (code == lastCode && (uint16_t)(now - lastStamp) < REPEAT_MAX_INTERVAL_MS) {
+    intervalRecord(stats.repeatIn, now - lastStamp);
+  }
+  lastCode = code;
+  lastStamp = now;
+  if (++count > stats.keyBufferPeak) {
+    stats.keyBufferPeak = count;
+  }
+  return true;
+}
+
+uint16_t keyQuietMs() {
+  return (uint16_t)millis() - lastStamp;
+}
+
+uint8_t keyBufferCount() {
+  return keyHead - keyTail;
+}
+
+uint16_t keyBufferGet(uint16_t* stamp) {
+  uint16_t code = keyBuffer[keyTail & (KEY_BUFFER_SIZE - 1)];
+  *stamp = keyStamps[keyTail & (KEY_BUFFER_SIZE - 1)];
+  keyTail++;
+  return code;
+}
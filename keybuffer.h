@@ -0,0 +1,77 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file keybuffer.h
+ * @brief Burst buffer between the PS/2 library and the translator
+ *
+ * PS2KeyAdvanced only buffers a few keys. The sketch drains the library
+ * into this much larger ring on every pass through loop() and only
+ * translates a key once the output queue has room for its frames. Fast
+ * devices such as barcode wedges therefore never overflow the library,
+ * and the backlog drains at the speed of the MBC line.
+ */
+
+#ifndef KEYBUFFER_H
+#define KEYBUFFER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#if KEY_BUFFER_SIZE > 128 || (KEY_BUFFER_SIZE & (KEY_BUFFER_SIZE - 1))
+#error "KEY_BUFFER_SIZE has to be a power of two, at most 128"
+#endif
+
+/**
+ * @brief Store a key code at the end of the burst buffer
+ *
+ * @param code PS2KeyAdvanced key code including status bits
+ * @return false if the buffer was full and the code had to be dropped
+ */
+bool keyBufferPut(uint16_t code);
+
+/**
+ * @return Number of key codes waiting for translation
+ */
+uint8_t keyBufferCount();
+
+/**
+ * @brief Take the oldest key code from the burst buffer
+ *
+ * Only call if keyBufferCount() is not zero.
+ *
+ * @param stamp Receives the millis() value (low 16 bits) at which the
+ *              key was taken from the PS2 library
+ */
+uint16_t keyBufferGet(uint16_t* stamp);
+
+/**
+ * @return Milliseconds since the last key arrived, modulo 65536
+ */
+uint16_t keyQuietMs();
+
+/**
+ * @brief Move all keys from the PS2 library into the burst buffer
+ *
+ * Implemented by the sketch, which owns the keyboard.
+ */
+void ingestKeys();
+
+#endif
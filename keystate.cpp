@@ -0,0 +1,165 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file keystate.cpp
+ * @brief Modifier and lock tracking for input backends without PS2KeyAdvanced
+ */
+
+#include "keystate.h"
+#include <PS2KeyAdvanced.h>
+
+// modifiers currently held down
+#define MOD_L_SHIFT 0x01
+#define MOD_R_SHIFT 0x02
+#define MOD_L_CTRL 0x04
+#define MOD_R_CTRL 0x08
+#define MOD_L_ALT 0x10
+#define MOD_R_ALT 0x20
+#define MOD_L_GUI 0x40
+#define MOD_R_GUI 0x80
+
+static uint8_t modifiers = 0;
+static bool capsLock = false;
+static bool numLock = true;
+
+// keypad with num lock off, indexed by PS2_KEY_KP0 .. PS2_KEY_KP_DOT
+static const uint8_t keypadNavigation[] PROGMEM = {
+  PS2_KEY_INSERT,    // KP0
+  PS2_KEY_END,       // KP1
+  PS2_KEY_DN_ARROW,  // KP2
+  PS2_KEY_PGDN,      // KP3
+  PS2_KEY_L_ARROW,   // KP4
+  0,                 // KP5
+  PS2_KEY_R_ARROW,   // KP6
+  PS2_KEY_HOME,      // KP7
+  PS2_KEY_UP_ARROW,  // KP8
+  PS2_KEY_PGUP,      // KP9
+  PS2_KEY_DELETE,    // KP_DOT
+};
+
+static uint8_t modifierBit(uint8_t key) {
+  switch (key) {
+    case PS2_KEY_L_SHIFT:
+      return MOD_L_SHIFT;
+    case PS2_KEY_R_SHIFT:
+      return MOD_R_SHIFT;
+    case PS2_KEY_L_CTRL:
+      return MOD_L_CTRL;
+    case PS2_KEY_R_CTRL:
+      return MOD_R_CTRL;
+    case PS2_KEY_L_ALT:
+      return MOD_L_ALT;
+    case PS2_KEY_R_ALT:
+      return MOD_R_ALT;
+    case PS2_KEY_L_GUI:
+      return MOD_L_GUI;
+    case PS2_KEY_R_GUI:
+      return MOD_R_GUI;
+    default:
+      return 0;
+  }
+}
+
+bool keyRepeats(uint8_t key) {
+  return !modifierBit(key) && key != PS2_KEY_CAPS && key != PS2_KEY_NUM && key != PS2_KEY_SCROLL;
+}
+
+/**
+ * @return Key as seen with the current num lock state, 0 for none
+ */
+static uint8_t keypadKey(uint8_t key) {
+  if (!numLock && key >= PS2_KEY_KP0 && key <= PS2_KEY_KP_DOT) {
+    return pgm_read_byte(&keypadNavigation[key - PS2_KEY_KP0]);
+  }
+  return key;
+}
+
+static uint16_t statusBits() {
+  uint16_t status = 0;
+  if (modifiers & (MOD_L_SHIFT | MOD_R_SHIFT)) {
+    status |= PS2_SHIFT;
+  }
+  if (modifiers & (MOD_L_CTRL | MOD_R_CTRL)) {
+    status |= PS2_CTRL;
+  }
+  if (modifiers & MOD_L_ALT) {
+    status |= PS2_ALT;
+  }
+  if (modifiers & MOD_R_ALT) {
+    status |= PS2_ALT_GR;
+  }
+  if (modifiers & (MOD_L_GUI | MOD_R_GUI)) {
+    status |= PS2_GUI;
+  }
+  if (capsLock) {
+    status |= PS2_CAPS;
+  }
+  return status;
+}
+
+uint16_t keyEvent(uint8_t key, bool make) {
+  uint8_t bit = modifierBit(key);
+  if (bit) {
+    bool repeat = modifiers & bit;
+    if (make) {
+      modifiers |= bit;
+    } else {
+      modifiers &= ~bit;
+    }
+    // no break codes, no repeated modifiers
+    if (!make || repeat) {
+      return 0;
+    }
+    return key | statusBits() | PS2_FUNCTION;
+  }
+
+  if (!make) {
+#ifdef REPEAT_ACCEL
+    // ends the adapter's own repeat
+    key = keypadKey(key);
+    return key ? key | PS2_BREAK : 0;
+#else
+    return 0;
+#endif
+  }
+
+  switch (key) {
+    case PS2_KEY_CAPS:
+      capsLock = !capsLock;
+      break;
+    case PS2_KEY_NUM:
+      numLock = !numLock;
+      break;
+    default:
+      break;
+  }
+
+  key = keypadKey(key);
+  if (key == 0) {
+    return 0;
+  }
+
+  uint16_t code = key | statusBits();
+  if (key < PS2_KEY_SPACE || key >= PS2_KEY_F1) {
+    code |= PS2_FUNCTION;
+  }
+  return code;
+}
@@ -0,0 +1,59 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file keystate.h
+ * @brief Modifier and lock tracking for input backends without PS2KeyAdvanced
+ *
+ * Input backends that see raw key presses and releases (the input
+ * capture PS/2 receiver, a key matrix) turn them into the same 16 bit
+ * codes PS2KeyAdvanced delivers: key code in the low byte, PS2_SHIFT,
+ * PS2_CTRL, PS2_ALT, PS2_ALT_GR, PS2_GUI and PS2_CAPS above. The library
+ * is configured with setNoBreak(1) and setNoRepeat(1), so releases and
+ * repeated modifiers produce no code here either. With REPEAT_ACCEL,
+ * the adapter repeats keys itself and needs the releases: other keys
+ * than modifiers then report them with PS2_BREAK.
+ *
+ * With Num Lock off, keypad keys turn into the cursor keys printed on
+ * them. Num Lock is on at power-up.
+ */
+
+#ifndef KEYSTATE_H
+#define KEYSTATE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/**
+ * @brief Feed a key press or release
+ *
+ * @param key PS2_KEY_* code
+ * @param make true for a press (or typematic repeat), false for a release
+ * @return Code as delivered by PS2KeyAdvanced, 0 if nothing is to be
+ *         reported
+ */
+uint16_t keyEvent(uint8_t key, bool make);
+
+/**
+ * @return false for modifier and lock keys, which do not repeat
+ */
+bool keyRepeats(uint8_t key);
+
+#endif
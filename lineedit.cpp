@@ -0,0 +1,237 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file lineedit.cpp
+ * @brief Line buffer, editing keys and history ring
+ */
+
+#include "lineedit.h"
+
+#ifdef LINE_EDIT
+
+#include <PS2KeyAdvanced.h>
+#include "output.h"
+#include "translate.h"
+#include "stats.h"
+
+// A sent line stays in its history slot, which is the job's data, so
+// the slot is only reused once its ticket is done. Tickets start out
+// as 0, which is always done.
+struct HistoryLine {
+  uint8_t text[LINE_EDIT_LENGTH + 1];  // line and CR
+  uint8_t length;                      // including the CR, 0 if unused
+  uint16_t ticket;
+};
+static HistoryLine history[LINE_HISTORY];
+static uint8_t newest = LINE_HISTORY - 1;  // slot of the last line sent
+// lines not worth recalling, a bare CR or a line flushed without one
+static HistoryLine scratch;
+
+// line being edited
+static uint8_t buffer[LINE_EDIT_LENGTH];
+static uint8_t length = 0;
+static uint8_t cursor = 0;
+static bool overwrite = false;
+// lines back from the newest while recalling, 0 for a new line
+static uint8_t recalled = 0;
+
+static bool active = false;
+
+bool lineEditActive() {
+  return active;
+}
+
+/**
+ * @brief Copy the buffer into the next history slot and submit it
+ *
+ * A line without CR or an empty one is not a command worth recalling;
+ * it is sent from the scratch line and leaves the history alone.
+ *
+ * @return false if the slot is still being sent or the lane is full
+ */
+static bool sendLine(bool withCr) {
+  bool keep = withCr && length;
+  uint8_t slot = (newest + 1) % LINE_HISTORY;
+  HistoryLine& line = keep ? history[slot] : scratch;
+  if (!mbcJobDone(LANE_HIGH, line.ticket)) {
+    return false;
+  }
+  uint8_t sent = length;
+  memcpy(line.text, buffer, length);
+  if (withCr) {
+    line.text[sent++] = '\r';
+  }
+  if (!mbcSubmit(LANE_HIGH, line.text, sent, 0, &line.ticket)) {
+    // the oldest line is overwritten already, the retry takes its slot
+    if (keep) {
+      line.length = 0;
+    }
+    return false;
+  }
+  stats.lineFrames += sent;
+  if (keep) {
+    line.length = sent;
+    newest = slot;
+  }
+  length = 0;
+  cursor = 0;
+  recalled = 0;
+  return true;
+}
+
+void lineEditToggle() {
+  if (active && length && !sendLine(false)) {
+    // keep the mode rather than lose the line
+    return;
+  }
+  active = !active;
+  length = 0;
+  cursor = 0;
+  recalled = 0;
+}
+
+bool lineEditResend() {
+  HistoryLine& line = history[newest];
+  if (!line.length || !mbcJobDone(LANE_HIGH, line.ticket)) {
+    return false;
+  }
+  if (!mbcSubmit(LANE_HIGH, line.text, line.length, 0, &line.ticket)) {
+    return false;
+  }
+  stats.lineFrames += line.length;
+  return true;
+}
+
+/**
+ * @brief Load a line from the history into the buffer
+ *
+ * @param back Lines back from the newest, 0 for an empty line
+ * @return false if there is no such line
+ */
+static bool recall(uint8_t back) {
+  if (back > LINE_HISTORY) {
+    return false;
+  }
+  const HistoryLine& line = history[(newest + LINE_HISTORY + 1 - back) % LINE_HISTORY];
+  if (back && !line.length) {
+    return false;
+  }
+  length = back ? line.length - 1 : 0;
+  memcpy(buffer, line.text, length);
+  cursor = length;
+  recalled = back;
+  return true;
+}
+
+static void insert(uint8_t c) {
+  if (overwrite && cursor < length) {
+    buffer[cursor++] = c;
+    return;
+  }
+  if (length == LINE_EDIT_LENGTH) {
+    return;
+  }
+  memmove(buffer + cursor + 1, buffer + cursor, length - cursor);
+  buffer[cursor++] = c;
+  length++;
+}
+
+static void erase(uint8_t at) {
+  memmove(buffer + at, buffer + at + 1, length - at - 1);
+  length--;
+}
+
+/**
+ * @return true if the key is one of the editing keys
+ */
+static bool editKey(uint8_t key) {
+  switch (key) {
+    case PS2_KEY_ENTER:
+    case PS2_KEY_KP_ENTER:
+      // if the output is busy, the line is kept for another try
+      sendLine(true);
+      return true;
+    case PS2_KEY_L_ARROW:
+      if (cursor) {
+        cursor--;
+      }
+      return true;
+    case PS2_KEY_R_ARROW:
+      if (cursor < length) {
+        cursor++;
+      }
+      return true;
+    case PS2_KEY_HOME:
+      cursor = 0;
+      return true;
+    case PS2_KEY_END:
+      cursor = length;
+      return true;
+    case PS2_KEY_BS:
+      if (cursor) {
+        erase(--cursor);
+      }
+      return true;
+    case PS2_KEY_DELETE:
+      if (cursor < length) {
+        erase(cursor);
+      }
+      return true;
+    case PS2_KEY_INSERT:
+      overwrite = !overwrite;
+      return true;
+    case PS2_KEY_ESC:
+      recall(0);
+      return true;
+    case PS2_KEY_UP_ARROW:
+      recall(recalled + 1);
+      return true;
+    case PS2_KEY_DN_ARROW:
+      if (recalled) {
+        recall(recalled - 1);
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool lineEditKey(uint16_t code) {
+  if (!active) {
+    return false;
+  }
+  // CTRL and ALT combinations keep their meaning
+  if (code & (PS2_CTRL | PS2_ALT | PS2_ALT_GR | PS2_GUI)) {
+    return false;
+  }
+  if (!((code & PS2_FUNCTION) && editKey(code & 0xFF))) {
+    // printable characters go into the buffer, anything else to the mbc
+    SeqFrame frame;
+    if (!translateKey(code, &frame) || frame.flags || frame.code < ' ' || frame.code == 0x7F) {
+      return false;
+    }
+    insert(frame.code);
+  }
+  stats.lineKeys++;
+  return true;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file lineedit.h
+ * @brief Local line editing and command history for MS-DOS on the MBC
+ *
+ * In line mode, printable keys are collected in a buffer on the adapter
+ * instead of being sent one by one. The cursor keys, Home/End, Backspace,
+ * Delete and Insert edit the buffer, Esc clears it. RETURN sends the line
+ * and the CR as one job, and keeps it in a small history: Up and Down
+ * recall earlier lines into the buffer, CTRL-ALT-R sends the last line
+ * again. Corrections never reach the serial line.
+ *
+ * The buffer is not shown on the MBC's screen. Keys the buffer has no use
+ * for, e.g. control codes, are sent right away as usual.
+ *
+ * CTRL-ALT-L turns line mode on and off.
+ */
+
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef LINE_EDIT
+
+/**
+ * @brief Turn line mode on or off; leaving it sends the buffer, without CR
+ */
+void lineEditToggle();
+
+/**
+ * @return true while line mode is on
+ */
+bool lineEditActive();
+
+/**
+ * @brief Edit the buffer with a key
+ *
+ * @param code PS2KeyAdvanced code including status bits
+ * @return true if the key has been handled, false to send it as usual
+ */
+bool lineEditKey(uint16_t code);
+
+/**
+ * @brief Send the last line again, including the CR
+ *
+ * @return false if there is none or the output is busy
+ */
+bool lineEditResend();
+
+#endif
+
+#endif
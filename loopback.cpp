@@ -0,0 +1,259 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file loopback.cpp
+ * @brief Timer1 edge capture and a software uart receiver for checking
+ */
+
+#include "loopback.h"
+
+#ifdef TX_LOOPBACK
+
+#include <util/atomic.h>
+#include "stats.h"
+
+// Timer1 runs at F_CPU / 8, one tick is half a microsecond
+#define TICKS_PER_US 2
+#define BIT_TICKS (1000000UL * TICKS_PER_US / MBC_BAUD)
+
+// edges from the isr to the decoder, power of two
+#define EDGE_BUFFER_SIZE 32
+// frames handed to the uart and not yet seen on the line, power of two
+#define EXPECT_BUFFER_SIZE 4
+
+struct Edge {
+  uint32_t at;    // timer ticks, extended to 32 bits
+  uint8_t level;  // line level after the edge
+};
+
+static volatile Edge edges[EDGE_BUFFER_SIZE];
+static volatile uint8_t edgeHead;
+static uint8_t edgeTail;
+static volatile uint16_t overflows;
+
+static uint8_t expected[EXPECT_BUFFER_SIZE];
+static uint8_t expectedOdd;  // parity per entry, one bit each
+static uint8_t expectHead;
+static uint8_t expectTail;
+
+// decoder state
+static bool inFrame = false;
+static uint32_t frameStart;
+static uint32_t lastStart;     // start of the previous frame
+static bool havePrevious = false;
+static uint8_t position;       // bit periods decoded so far
+static uint16_t bits;          // levels of the decoded bits, start bit first
+static uint8_t level;          // line level since the last edge
+static uint32_t lastEdge;      // time of the last edge within the frame
+
+ISR(TIMER1_OVF_vect) {
+  overflows++;
+}
+
+ISR(TIMER1_CAPT_vect) {
+  uint16_t low = ICR1;
+  uint16_t high = overflows;
+  // the capture may precede an overflow that is still pending
+  if ((TIFR1 & _BV(TOV1)) && low < 0x8000) {
+    high++;
+  }
+  // a rising edge was captured if ICES1 is set; look for the other one next
+  uint8_t rising = TCCR1B & _BV(ICES1);
+  TCCR1B ^= _BV(ICES1);
+  TIFR1 = _BV(ICF1);
+
+  uint8_t head = edgeHead;
+  if ((uint8_t)(head - edgeTail) >= EDGE_BUFFER_SIZE) {
+    return;
+  }
+  volatile Edge& edge = edges[head & (EDGE_BUFFER_SIZE - 1)];
+  edge.at = ((uint32_t)high << 16) | low;
+  edge.level = rising ? 1 : 0;
+  edgeHead = head + 1;
+}
+
+void loopbackBegin() {
+  pinMode(8, INPUT);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // normal mode, noise canceler, falling edge first, clk/8
+    TCCR1A = 0;
+    TCCR1B = _BV(ICNC1) | _BV(CS11);
+    TIFR1 = _BV(ICF1) | _BV(TOV1);
+    TIMSK1 = _BV(ICIE1) | _BV(TOIE1);
+  }
+}
+
+void loopbackExpect(uint8_t code, bool odd) {
+  if ((uint8_t)(expectHead - expectTail) >= EXPECT_BUFFER_SIZE) {
+    // the line is not looped back, forget the oldest
+    expectTail++;
+  }
+  uint8_t slot = expectHead & (EXPECT_BUFFER_SIZE - 1);
+  expected[slot] = code;
+  if (odd) {
+    expectedOdd |= 1 << slot;
+  } else {
+    expectedOdd &= ~(1 << slot);
+  }
+  expectHead++;
+}
+
+/**
+ * @return Current time in timer ticks, extended like the edges
+ */
+static uint32_t now() {
+  uint16_t low;
+  uint16_t high;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    low = TCNT1;
+    high = overflows;
+    if ((TIFR1 & _BV(TOV1)) && low < 0x8000) {
+      high++;
+    }
+  }
+  return ((uint32_t)high << 16) | low;
+}
+
+/**
+ * @brief Record the level of the bit periods up to a position
+ */
+static void fillBits(uint8_t upTo) {
+  while (position < upTo && position < MBC_FRAME_BITS) {
+    if (level) {
+      bits |= 1 << position;
+    }
+    position++;
+  }
+}
+
+/**
+ * @brief Check a complete frame against the expected one
+ */
+static void finishFrame() {
+  fillBits(MBC_FRAME_BITS);
+  inFrame = false;
+  stats.loopback.frames++;
+
+  if (havePrevious) {
+    // idle is the time after the parity bit: stop bits plus the gap
+    uint32_t period = (frameStart - lastStart) / TICKS_PER_US;
+    uint16_t idle = min(period - 10 * BIT_TICKS / TICKS_PER_US, 0xFFFFUL);
+    if (stats.loopback.gaps == 0 || idle < stats.loopback.idleMin) {
+      stats.loopback.idleMin = idle;
+      stats.loopback.periodMin = min(period, 0xFFFFUL);
+    }
+    if (idle > stats.loopback.idleMax) {
+      stats.loopback.idleMax = idle;
+    }
+    stats.loopback.gaps++;
+  }
+  lastStart = frameStart;
+  havePrevious = true;
+
+  uint8_t code = bits >> 1;
+  uint8_t ones = 0;
+  for (uint16_t b = bits >> 1 & 0x1FF; b; b >>= 1) {
+    ones += b & 1;
+  }
+  bool odd = ones & 1;
+  if (odd) {
+    stats.loopback.odd++;
+  }
+  if ((bits >> 10 & 3) != 3) {
+    stats.loopback.framingErrors++;
+  }
+
+  if (expectHead == expectTail) {
+    stats.loopback.mismatches++;
+    return;
+  }
+  uint8_t slot = expectTail & (EXPECT_BUFFER_SIZE - 1);
+  expectTail++;
+  if (expected[slot] != code || ((expectedOdd >> slot) & 1) != odd) {
+    stats.loopback.mismatches++;
+  }
+}
+
+/**
+ * @brief Account for an edge at the given time
+ */
+static void decodeEdge(uint32_t at, uint8_t newLevel) {
+  if (!inFrame) {
+    if (newLevel) {
+      // rising edge while idle, the end of a glitch
+      return;
+    }
+    // start bit
+    inFrame = true;
+    frameStart = at;
+    lastEdge = at;
+    position = 0;
+    bits = 0;
+    level = 0;
+    return;
+  }
+
+  uint32_t elapsed = at - frameStart;
+  if (at - lastEdge < BIT_TICKS / 2) {
+    // too short for a bit, e.g. the uart being switched off and on
+    stats.loopback.glitches++;
+    if (position == 0 && newLevel) {
+      // it was not a start bit after all
+      inFrame = false;
+    }
+    return;
+  }
+  uint8_t bitPosition = (elapsed + BIT_TICKS / 2) / BIT_TICKS;
+  if (bitPosition >= MBC_FRAME_BITS) {
+    // the frame ended unnoticed, this edge starts the next one
+    finishFrame();
+    decodeEdge(at, newLevel);
+    return;
+  }
+
+  // deviation of the edge from its ideal position
+  int32_t deviation = (int32_t)(elapsed - (uint32_t)bitPosition * BIT_TICKS);
+  uint16_t jitter = (deviation < 0 ? -deviation : deviation) / TICKS_PER_US;
+  if (jitter > stats.loopback.jitterMax) {
+    stats.loopback.jitterMax = jitter;
+  }
+  stats.loopback.bitTicks += elapsed;
+  stats.loopback.bitCount += bitPosition;
+
+  fillBits(bitPosition);
+  level = newLevel;
+  lastEdge = at;
+}
+
+void loopbackService() {
+  while (edgeTail != edgeHead) {
+    // the isr does not touch the entry until it is consumed
+    volatile Edge& edge = edges[edgeTail & (EDGE_BUFFER_SIZE - 1)];
+    decodeEdge(edge.at, edge.level);
+    edgeTail++;
+  }
+  // the last frame ends without an edge once its stop bits have passed
+  if (inFrame && now() - frameStart > MBC_FRAME_BITS * BIT_TICKS) {
+    finishFrame();
+  }
+}
+
+#endif
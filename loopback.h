@@ -0,0 +1,62 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file loopback.h
+ * @brief Measures the frames on the MBC line through a TX loopback
+ *
+ * The TX pin is wired back to ICP1 (pin 8), and Timer1 timestamps every
+ * edge on the line in half microseconds. The edges are decoded in the
+ * main loop like a receiving uart would: code, parity and stop bits of
+ * every frame are checked against what the output queue meant to send,
+ * and the bit time, the largest deviation of an edge from its ideal
+ * position and the idle time between frames are recorded in the stats.
+ * Pulses shorter than half a bit, e.g. from reconfiguring the uart for
+ * the other parity, are counted as glitches.
+ */
+
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef TX_LOOPBACK
+
+/**
+ * @brief Start timestamping the line
+ */
+void loopbackBegin();
+
+/**
+ * @brief Tell the decoder about a frame handed to the uart
+ *
+ * @param odd true if sent with a parity error
+ */
+void loopbackExpect(uint8_t code, bool odd);
+
+/**
+ * @brief Decode the edges captured so far. Call on every pass through loop().
+ */
+void loopbackService();
+
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file matrix.cpp
+ * @brief Row scanning, vertical counter debounce and key repeat
+ */
+
+#include "matrix.h"
+
+#ifdef MATRIX
+
+#include <PS2KeyAdvanced.h>
+#include "debounce.h"
+#include "keystate.h"
+#include "seqlock.h"
+#include "stats.h"
+#include "tick.h"
+#include "typematic.h"
+
+// row pins, top to bottom
+static const uint8_t rowPins[MATRIX_ROWS] PROGMEM = {MATRIX_ROW_PINS};
+
+// PS2_KEY_* code of each switch, 0 where there is none. The example is a
+// 54 key layout; adapt it to the wiring of the keyboard.
+static const uint8_t keymap[MATRIX_ROWS][8] PROGMEM = {
+  {PS2_KEY_ESC, PS2_KEY_1, PS2_KEY_2, PS2_KEY_3, PS2_KEY_4, PS2_KEY_5},
+  {PS2_KEY_6, PS2_KEY_7, PS2_KEY_8, PS2_KEY_9, PS2_KEY_0, PS2_KEY_MINUS},
+  {PS2_KEY_TAB, PS2_KEY_Q, PS2_KEY_W, PS2_KEY_E, PS2_KEY_R, PS2_KEY_T},
+  {PS2_KEY_Y, PS2_KEY_U, PS2_KEY_I, PS2_KEY_O, PS2_KEY_P, PS2_KEY_BS},
+  {PS2_KEY_CAPS, PS2_KEY_A, PS2_KEY_S, PS2_KEY_D, PS2_KEY_F, PS2_KEY_G},
+  {PS2_KEY_H, PS2_KEY_J, PS2_KEY_K, PS2_KEY_L, PS2_KEY_SEMI, PS2_KEY_ENTER},
+  {PS2_KEY_L_SHIFT, PS2_KEY_Z, PS2_KEY_X, PS2_KEY_C, PS2_KEY_V, PS2_KEY_B},
+  {PS2_KEY_N, PS2_KEY_M, PS2_KEY_COMMA, PS2_KEY_DOT, PS2_KEY_DIV, PS2_KEY_R_SHIFT},
+  {PS2_KEY_L_CTRL, PS2_KEY_L_ALT, PS2_KEY_SPACE, PS2_KEY_APOS, PS2_KEY_EQUAL, PS2_KEY_DELETE},
+};
+
+// data direction register and bit of each row, looked up once
+static volatile uint8_t* rowDdr[MATRIX_ROWS];
+static uint8_t rowBit[MATRIX_ROWS];
+
+// debounced state and vertical counters, one bit per column
+static DebounceRow debounce[MATRIX_ROWS];
+static uint8_t row = 0;
+
+// changes found by the interrupt: bit 7 press, bits 3-6 row, bits 0-2 column
+#define MATRIX_EVENT_BUFFER 16
+#define MATRIX_MAKE 0x80
+static volatile uint8_t events[MATRIX_EVENT_BUFFER];
+static volatile uint8_t eventHead = 0;
+static uint8_t eventTail = 0;
+
+static volatile uint32_t scans = 0;
+static volatile uint16_t overruns = 0;
+static Seqlock countersSeq;
+
+#ifndef REPEAT_ACCEL
+// key being repeated, 0 for none
+static uint8_t repeatKey = 0;
+static uint16_t repeatAt;
+#endif
+
+static void selectRow(uint8_t r) {
+  // open drain: a row is driven low by making it an output
+  *rowDdr[r] |= rowBit[r];
+}
+
+static void releaseRow(uint8_t r) {
+  *rowDdr[r] &= ~rowBit[r];
+}
+
+void matrixBegin() {
+  for (uint8_t r = 0; r < MATRIX_ROWS; r++) {
+    uint8_t pin = pgm_read_byte(&rowPins[r]);
+    pinMode(pin, INPUT);
+    digitalWrite(pin, LOW);
+    rowDdr[r] = portModeRegister(digitalPinToPort(pin));
+    rowBit[r] = digitalPinToBitMask(pin);
+  }
+  MATRIX_COL_DDR &= ~MATRIX_COL_MASK;
+  MATRIX_COL_PORT |= MATRIX_COL_MASK;
+
+  row = 0;
+  selectRow(row);
+  tickBegin();
+}
+
+void matrixScan() {
+  // pressed keys pull their column low
+  uint8_t sample = ~MATRIX_COL_PINREG & MATRIX_COL_MASK;
+  uint8_t toggle = debounceRow(debounce[row], sample);
+
+  for (uint8_t col = 0; toggle; col++, toggle >>= 1) {
+    if (toggle & 1) {
+      uint8_t head = eventHead;
+      if ((uint8_t)(head - eventTail) >= MATRIX_EVENT_BUFFER) {
+        // the key's state has changed anyway, its event is lost
+        overruns++;
+        continue;
+      }
+      uint8_t make = (debounce[row].state >> col) & 1 ? MATRIX_MAKE : 0;
+      events[head & (MATRIX_EVENT_BUFFER - 1)] = make | (row << 3) | col;
+      eventHead = head + 1;
+    }
+  }
+
+  releaseRow(row);
+  if (++row >= MATRIX_ROWS) {
+    row = 0;
+    scans++;
+  }
+  seqlockWrite(countersSeq);
+  selectRow(row);
+}
+
+bool matrixRead(uint16_t* code) {
+  while (eventTail != eventHead) {
+    uint8_t event = events[eventTail & (MATRIX_EVENT_BUFFER - 1)];
+    eventTail++;
+    uint8_t key = pgm_read_byte(&keymap[(event >> 3) & 0x0F][event & 0x07]);
+    if (key == 0) {
+      continue;
+    }
+    bool make = event & MATRIX_MAKE;
+
+#ifndef REPEAT_ACCEL
+    // the last key pressed repeats
+    if (make && keyRepeats(key)) {
+      repeatKey = key;
+      repeatAt = (uint16_t)millis() + (repeatDelay + 1) * 250;
+    } else if (!make && key == repeatKey) {
+      repeatKey = 0;
+    }
+#endif
+
+    *code = keyEvent(key, make);
+    if (*code) {
+      return true;
+    }
+  }
+
+#ifndef REPEAT_ACCEL
+  if (repeatKey && (int16_t)((uint16_t)millis() - repeatAt) >= 0) {
+    repeatAt = (uint16_t)millis() + 1000 / typematicCps(typematicRate(repeatCps));
+    *code = keyEvent(repeatKey, true);
+    return *code != 0;
+  }
+#endif
+  return false;
+}
+
+void matrixStats() {
+  uint8_t seq;
+  do {
+    seq = seqlockReadBegin(countersSeq);
+    stats.matrixScans = scans;
+    stats.matrixOverruns = overruns;
+  } while (seqlockReadRetry(countersSeq, seq));
+}
+
+#endif
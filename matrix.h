@@ -0,0 +1,83 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file matrix.h
+ * @brief Input backend scanning a key matrix on the Nano's pins
+ *
+ * For replacement keyboards built from new switches, MATRIX scans the
+ * switches directly instead of reading a PS/2 keyboard. Rows are driven
+ * low one at a time; the columns are one port's pins with pull-ups and
+ * are read with a single register read. Each key needs a diode (anode
+ * on the column) so that any number of keys can be held at once.
+ *
+ * One row is scanned per Timer2 tick (see tick.h), the row for the next
+ * tick is selected right away so the lines have a full tick to settle:
+ * with 9 rows, the whole matrix is scanned about 1000 times a second.
+ * Debouncing uses vertical counters, two bits per key packed into two
+ * bytes per row: a key changes state after 4 equal samples in a row,
+ * see debounce.h.
+ *
+ * Key presses and releases go through keystate.h into the same codes
+ * the PS/2 backends deliver. Keys repeat at the rate and delay set for
+ * PS/2 keyboards, see typematic.h.
+ */
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef MATRIX
+
+#if defined(PS2_CAPTURE)
+#error "MATRIX and PS2_CAPTURE are separate input backends, enable only one"
+#endif
+#if MATRIX_ROWS > 16
+#error "MATRIX_ROWS has to be 16 or less"
+#endif
+
+/**
+ * @brief Configure the pins and start scanning
+ */
+void matrixBegin();
+
+/**
+ * @brief Scan one row. Called by the Timer2 interrupt.
+ */
+void matrixScan();
+
+/**
+ * @brief Turn key changes into key codes, repeat held keys
+ *
+ * @param code Receives the next key code
+ * @return false if no key is available
+ */
+bool matrixRead(uint16_t* code);
+
+/**
+ * @brief Copy the scanner's counters into the stats
+ */
+void matrixStats();
+
+#endif
+
+#endif
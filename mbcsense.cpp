@@ -0,0 +1,93 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file mbcsense.cpp
+ * @brief Power and reset sensing on the MBC side of the cable
+ */
+
+#include "mbcsense.h"
+
+#ifdef MBC_SENSE
+
+#include "stats.h"
+
+// both lines share the port d pin change interrupt
+static_assert(MBC_POWER_PIN < 8 && MBC_RESET_SENSE_PIN < 8,
+              "MBC sense pins have to be on port D (pins 0-7)");
+
+#define MBC_DOWN 0     // no power or reset held low
+#define MBC_BOOTING 1  // back up, waiting for MBC_BOOT_DELAY_MS
+#define MBC_UP 2       // ready for frames
+
+static uint8_t mbcState = MBC_DOWN;
+static unsigned long bootStart = 0;
+
+// latched by the interrupt, so even short reset pulses are seen
+static volatile bool downSeen = false;
+
+ISR(PCINT2_vect) {
+  const uint8_t mask = _BV(MBC_POWER_PIN) | _BV(MBC_RESET_SENSE_PIN);
+  if ((PIND & mask) != mask) {
+    downSeen = true;
+  }
+}
+
+void mbcSenseBegin() {
+  pinMode(MBC_POWER_PIN, INPUT);
+  pinMode(MBC_RESET_SENSE_PIN, INPUT);
+  PCMSK2 |= _BV(MBC_POWER_PIN) | _BV(MBC_RESET_SENSE_PIN);
+  PCICR |= _BV(PCIE2);
+  mbcState = MBC_DOWN;
+}
+
+bool mbcSenseUpdate() {
+  bool up = digitalRead(MBC_POWER_PIN) && digitalRead(MBC_RESET_SENSE_PIN);
+
+  noInterrupts();
+  bool seen = downSeen;
+  downSeen = false;
+  interrupts();
+
+  if (!up || seen) {
+    if (mbcState == MBC_UP) {
+      stats.mbcDownEvents++;
+    }
+    // a reset pulse that is already over starts the boot delay
+    mbcState = up ? MBC_BOOTING : MBC_DOWN;
+    bootStart = millis();
+  } else if (mbcState == MBC_DOWN) {
+    mbcState = MBC_BOOTING;
+    bootStart = millis();
+  } else if (mbcState == MBC_BOOTING && millis() - bootStart >= MBC_BOOT_DELAY_MS) {
+    mbcState = MBC_UP;
+  }
+  return mbcState == MBC_UP;
+}
+
+bool mbcReady() {
+  return mbcState == MBC_UP;
+}
+
+void mbcSenseReset() {
+  downSeen = true;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file mbcsense.h
+ * @brief Power and reset sensing on the MBC side of the cable
+ *
+ * Frames sent while the MBC is switched off or still booting are lost.
+ * With MBC_SENSE enabled, the adapter watches the VCC pin of the keyboard
+ * connector and the reset line. The output queue is held while the MBC
+ * is down and released MBC_BOOT_DELAY_MS after it came back, so pastes
+ * and macros survive a power cycle or a reset.
+ *
+ * This only makes sense if the Arduino is powered externally; when it
+ * runs from the MBC's VCC, it goes down together with the computer.
+ */
+
+#ifndef MBCSENSE_H
+#define MBCSENSE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef MBC_SENSE
+
+/**
+ * @brief Configure the sense pins and their pin change interrupt
+ */
+void mbcSenseBegin();
+
+/**
+ * @brief Update the MBC state from the sense lines
+ *
+ * @return true if the MBC is up and past its boot delay
+ */
+bool mbcSenseUpdate();
+
+/**
+ * @return State as of the last mbcSenseUpdate()
+ */
+bool mbcReady();
+
+/**
+ * @brief Note a reset pulse generated by the adapter itself
+ */
+void mbcSenseReset();
+
+#else
+
+static inline void mbcSenseBegin() {}
+static inline bool mbcSenseUpdate() {
+  return true;
+}
+static inline bool mbcReady() {
+  return true;
+}
+static inline void mbcSenseReset() {}
+
+#endif
+
+#endif
@@ -0,0 +1,471 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file output.cpp
+ * @brief Paced, parity aware output queue towards the MBC
+ */
+
+#include "output.h"
+#include <util/atomic.h>
+#include "mbcsense.h"
+#include "stats.h"
+#include "hostlink.h"
+#include "trace.h"
+#include "softuart.h"
+#include "loopback.h"
+#include "txring.h"
+#include "replay.h"
+
+// injected jobs, one ring per lane; the local counters index the ring,
+// tickets are counted per lane across all targets
+struct JobLane {
+  MbcJob jobs[JOB_QUEUE_SIZE];
+  uint16_t submitted;  // jobs accepted
+  uint16_t completed;  // jobs sent completely
+};
+
+// Each MBC has its own queues and pacing, so a slow or switched off
+// machine only holds up the frames meant for it.
+struct Target {
+  // head and tail run freely, the difference is the fill level
+  MbcFrame frames[FRAME_QUEUE_SIZE];
+  uint8_t frameHead;
+  uint8_t frameTail;
+  JobLane lanes[JOB_LANES];
+
+  // time the last frame was handed to the uart
+  unsigned long lastFrameAt;
+  // a frame has been handed to the uart and may still be on the wire
+  bool frameInFlight;
+  // last keystroke frame, to measure the spacing of repeats on the wire
+  uint8_t lastTimedCode;
+  uint16_t lastTimedAt;
+};
+static Target targets[MBC_TARGETS];
+
+// targets frames and jobs go to, one bit each
+static uint8_t targetMask = 1;
+// last ticket handed out per lane
+static uint16_t laneTickets[JOB_LANES];
+
+// parity the hardware uart is currently configured for
+static uint8_t activeParity = 0;
+
+// longer gaps are separate key presses, not repeats
+#define REPEAT_MAX_INTERVAL_MS 1000
+
+// frames go out on the uart; on the Nano the host link and debug
+// output take it over
+#if defined(MEGA) || !(defined(HOST_LINK) || defined(OUTPUT_DEBUG))
+#define MBC_WIRE 1
+#endif
+
+#define FOR_EACH_SELECTED(t) \
+  for (uint8_t t = 0; t < MBC_TARGETS; t++) \
+    if (targetMask & (1 << t))
+
+void outputBegin() {
+#if defined(HOST_LINK)
+  hostLinkBegin();
+#elif defined(MEGA)
+  // debug output on the usb port
+  Serial.begin(HOST_BAUD);
+#endif
+#if !defined(TINY) && (defined(MEGA) || !defined(HOST_LINK))
+  MBC_SERIAL.begin(MBC_BAUD, MBC_SR_CFG);
+#endif
+  activeParity = 0;
+#ifdef TX_LOOPBACK
+  loopbackBegin();
+#endif
+#ifdef TX_RING
+  txRingBegin();
+#endif
+#if SOFT_UARTS > 0
+  softUartBegin();
+#endif
+}
+
+void mbcSelectTarget(uint8_t target) {
+  targetMask = target == MBC_BROADCAST ? (1 << MBC_TARGETS) - 1 : 1 << target;
+}
+
+uint8_t mbcTarget() {
+  if (targetMask & (targetMask - 1)) {
+    return MBC_BROADCAST;
+  }
+  uint8_t target = 0;
+  while (!(targetMask & (1 << target))) {
+    target++;
+  }
+  return target;
+}
+
+uint8_t frameQueueFree() {
+  // a frame for several targets needs room in each of them
+  uint8_t free = FRAME_QUEUE_SIZE;
+  FOR_EACH_SELECTED(t) {
+    uint8_t targetFree = FRAME_QUEUE_SIZE - (uint8_t)(targets[t].frameHead - targets[t].frameTail);
+    if (targetFree < free) {
+      free = targetFree;
+    }
+  }
+  return free;
+}
+
+bool mbcEnqueueSequence(const SeqFrame* seq, uint8_t length, uint8_t flags, uint16_t origin) {
+  if (length == 0) {
+    return false;
+  }
+  // a sequence entry has no room for the origin
+  uint8_t single = (flags & FRAME_TIMED) || length == 1;
+  if (frameQueueFree() < single + (length > single)) {
+    return false;
+  }
+  if (single) {
+    mbcEnqueue(pgm_read_byte(&seq->code), (flags & FRAME_TIMED) | pgm_read_byte(&seq->flags), origin);
+    if (--length == 0) {
+      return true;
+    }
+    seq++;
+  }
+  mbcEnqueue(length, FRAME_SEQUENCE);
+  FOR_EACH_SELECTED(t) {
+    Target& target = targets[t];
+    target.frames[(uint8_t)(target.frameHead - 1) & (FRAME_QUEUE_SIZE - 1)].seq = seq;
+  }
+  stats.framesQueued += length - 1;
+  return true;
+}
+
+bool mbcEnqueue(uint8_t code, uint8_t flags, uint16_t origin) {
+  // all selected targets or none, so a retry never duplicates a frame
+  if (frameQueueFree() == 0) {
+    stats.framesDiscarded++;
+    return false;
+  }
+  if ((targetMask & 1) && !mbcReady()) {
+    stats.framesHeld++;
+  }
+  FOR_EACH_SELECTED(t) {
+    Target& target = targets[t];
+    MbcFrame& frame = target.frames[target.frameHead & (FRAME_QUEUE_SIZE - 1)];
+    frame.code = code;
+    frame.flags = flags;
+    frame.origin = origin;
+    target.frameHead++;
+    uint8_t count = target.frameHead - target.frameTail;
+    if (count > stats.frameQueuePeak) {
+      stats.frameQueuePeak = count;
+    }
+  }
+  stats.framesQueued++;
+  return true;
+}
+
+bool mbcSubmit(uint8_t lane, const uint8_t* data, uint16_t length,
+               uint8_t flags, uint16_t* ticket) {
+  FOR_EACH_SELECTED(t) {
+    JobLane& l = targets[t].lanes[lane];
+    if ((uint16_t)(l.submitted - l.completed) >= JOB_QUEUE_SIZE) {
+      stats.jobsRejected++;
+      return false;
+    }
+  }
+  *ticket = ++laneTickets[lane];
+  stats.jobsSubmitted++;
+  if ((targetMask & 1) && !mbcReady()) {
+    stats.framesHeld += length;
+  }
+
+  // empty jobs are done right away
+  if (length == 0) {
+    return true;
+  }
+  FOR_EACH_SELECTED(t) {
+    // every target reads the data with its own cursor
+    JobLane& l = targets[t].lanes[lane];
+    l.submitted++;
+    MbcJob& job = l.jobs[l.submitted & (JOB_QUEUE_SIZE - 1)];
+    job.data = data;
+    job.length = length;
+    job.flags = flags;
+    job.ticket = *ticket;
+    uint8_t waiting = l.submitted - l.completed;
+    if (waiting > stats.jobQueuePeak) {
+      stats.jobQueuePeak = waiting;
+    }
+  }
+  return true;
+}
+
+/**
+ * A ticket is done once no target has it or an earlier job of the lane
+ * still waiting. Jobs of a lane are sent in order on every target.
+ */
+bool mbcJobDone(uint8_t lane, uint16_t ticket) {
+  for (uint8_t t = 0; t < MBC_TARGETS; t++) {
+    JobLane& l = targets[t].lanes[lane];
+    if (l.submitted == l.completed) {
+      continue;
+    }
+    const MbcJob& first = l.jobs[(uint16_t)(l.completed + 1) & (JOB_QUEUE_SIZE - 1)];
+    if ((int16_t)(first.ticket - ticket) <= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool outputIdle() {
+#ifdef TX_RING
+  if (!txRingIdle()) {
+    return false;
+  }
+#endif
+  for (uint8_t t = 0; t < MBC_TARGETS; t++) {
+    Target& target = targets[t];
+    if (target.frameHead != target.frameTail) {
+      return false;
+    }
+    for (uint8_t i = 0; i < JOB_LANES; i++) {
+      if (target.lanes[i].submitted != target.lanes[i].completed) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Take the next frame: keyboard first, then the lanes in order
+ *
+ * @return false if nothing is waiting
+ */
+static bool nextFrame(Target& target, MbcFrame* frame) {
+  if (target.frameHead != target.frameTail) {
+    MbcFrame& head = target.frames[target.frameTail & (FRAME_QUEUE_SIZE - 1)];
+    if (!(head.flags & FRAME_SEQUENCE)) {
+      *frame = head;
+      target.frameTail++;
+      return true;
+    }
+    // walk the sequence in flash, the entry stays until its last frame
+    frame->code = pgm_read_byte(&head.seq->code);
+    frame->flags = pgm_read_byte(&head.seq->flags);
+    head.seq++;
+    if (--head.code == 0) {
+      target.frameTail++;
+    }
+    return true;
+  }
+  for (uint8_t i = 0; i < JOB_LANES; i++) {
+    JobLane& l = target.lanes[i];
+    if (l.submitted == l.completed) {
+      continue;
+    }
+    MbcJob& job = l.jobs[(uint16_t)(l.completed + 1) & (JOB_QUEUE_SIZE - 1)];
+    frame->code = (job.flags & JOB_PROGMEM) ? pgm_read_byte(job.data) : *job.data;
+    frame->flags = 0;
+    job.data++;
+    if (--job.length == 0) {
+      l.completed++;
+    }
+    stats.framesInjected++;
+    return true;
+  }
+  return false;
+}
+
+#if !defined(TX_RING) && !defined(TINY)
+/**
+ * The parity bit is part of the scan codes: the MBC expects a parity
+ * error for most CTRL combinations. The uart is only reconfigured when
+ * the parity actually changes, and only once the line is idle, so
+ * Serial.end() does not have to wait for a frame in flight.
+ */
+static void setParity(uint8_t parity) {
+  if (parity == activeParity) {
+    return;
+  }
+#if defined(MEGA) || !defined(HOST_LINK)
+  // the host link reports the parity with each frame instead
+  MBC_SERIAL.end();
+  MBC_SERIAL.begin(MBC_BAUD, parity ? MBC_SR_CFG_CTRL : MBC_SR_CFG);
+#endif
+  activeParity = parity;
+}
+#endif
+
+/**
+ * Bucket the time between a keystroke leaving the PS2 library and its
+ * frame being handed to the idle uart.
+ */
+static void recordLatency(uint16_t origin) {
+  uint16_t latency = (uint16_t)millis() - origin;
+  uint8_t bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && latency >= (1U << bucket)) {
+    bucket++;
+  }
+  if (stats.latency[bucket] < 0xFFFF) {
+    stats.latency[bucket]++;
+  }
+  if (latency > stats.latencyMax) {
+    stats.latencyMax = latency;
+  }
+}
+
+#if !defined(TX_RING) && !defined(TINY)
+/**
+ * The line is idle once the estimated transmit time of the last frame
+ * plus the gap has passed and the uart has shifted out its last bit.
+ * TXC is cleared by HardwareSerial whenever it loads a byte, so it is
+ * only set once the software buffer and the shift register are empty.
+ */
+static bool lineIdle(Target& target) {
+  if (!target.frameInFlight) {
+    return true;
+  }
+  if (micros() - target.lastFrameAt < MBC_FRAME_US + MBC_FRAME_GAP_US) {
+    return false;
+  }
+  if (MBC_SERIAL.availableForWrite() < SERIAL_TX_BUFFER_SIZE - 1) {
+    return false;
+  }
+  return bit_is_set(MBC_UCSRA, MBC_TXC);
+}
+#endif
+
+#ifndef TINY
+/**
+ * @brief Hand the next frame of the first MBC to the hardware uart
+ *
+ * @return true if a frame was sent
+ */
+static bool sendHardware(Target& target, MbcFrame* frame) {
+  // hold everything while the mbc is off or booting
+  if (!mbcSenseUpdate()) {
+    return false;
+  }
+#ifdef TX_RING
+  // the ring paces the line
+  if (txRingFree() == 0) {
+    return false;
+  }
+#else
+  if (!lineIdle(target)) {
+    return false;
+  }
+#endif
+  if (!nextFrame(target, frame)) {
+    return false;
+  }
+
+#ifndef TX_RING
+  setParity(frame->flags & FRAME_ODD_PARITY);
+#endif
+#if defined(HOST_LINK)
+  hostLinkFrame(frame->code, frame->flags);
+#elif defined(OUTPUT_DEBUG)
+  Serial.print("Output: (");
+  Serial.print(frame->code, HEX);
+  Serial.print(")\n");
+#endif
+#ifdef MBC_WIRE
+#ifdef TX_LOOPBACK
+  loopbackExpect(frame->code, frame->flags & FRAME_ODD_PARITY);
+#endif
+#ifdef TX_RING
+  txRingPush(frame->code, frame->flags);
+#else
+  MBC_SERIAL.write(frame->code);
+#endif
+#endif
+#ifdef TRACE
+  traceFrame(frame->code, frame->flags);
+#endif
+#ifdef REPLAY
+  replayFrame(frame->code, frame->flags);
+#endif
+  return true;
+}
+
+#endif
+
+#if SOFT_UARTS > 0
+/**
+ * @brief Hand the next frame of an MBC to its software uart
+ *
+ * The software uart sets the parity per frame, and its frame time is
+ * exact, so only the gap has to be waited for.
+ */
+static bool sendSoftware(uint8_t t, MbcFrame* frame) {
+  Target& target = targets[t];
+  // only the first mbc is sensed
+  if (t == 0 && !mbcSenseUpdate()) {
+    return false;
+  }
+  if (!softUartIdle(t - SOFT_UART_FIRST)) {
+    return false;
+  }
+  if (target.frameInFlight && micros() - target.lastFrameAt < MBC_FRAME_US + MBC_FRAME_GAP_US) {
+    return false;
+  }
+  if (!nextFrame(target, frame)) {
+    return false;
+  }
+  softUartWrite(t - SOFT_UART_FIRST, frame->code, frame->flags & FRAME_ODD_PARITY);
+  return true;
+}
+#endif
+
+void serviceOutput() {
+  for (uint8_t t = 0; t < MBC_TARGETS; t++) {
+    Target& target = targets[t];
+    MbcFrame frame;
+#if defined(TINY)
+    bool sent = sendSoftware(t, &frame);
+#elif SOFT_UARTS > 0
+    bool sent = t == 0 ? sendHardware(target, &frame) : sendSoftware(t, &frame);
+#else
+    bool sent = sendHardware(target, &frame);
+#endif
+    if (!sent) {
+      continue;
+    }
+    target.lastFrameAt = micros();
+    target.frameInFlight = true;
+
+    if (frame.flags & FRAME_TIMED) {
+      recordLatency(frame.origin);
+      uint16_t now = millis();
+      if (frame.code == target.lastTimedCode && (uint16_t)(now - target.lastTimedAt) < REPEAT_MAX_INTERVAL_MS) {
+        intervalRecord(stats.repeatOut, now - target.lastTimedAt);
+      }
+      target.lastTimedCode = frame.code;
+      target.lastTimedAt = now;
+    }
+    stats.framesSent++;
+    if (frame.flags & FRAME_ODD_PARITY) {
+      stats.framesOdd++;
+    }
+  }
+}
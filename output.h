@@ -0,0 +1,217 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file output.h
+ * @brief Paced, parity aware output queue towards the MBC
+ *
+ * Every code for the MBC is queued as a frame together with the parity
+ * it has to be sent with. serviceOutput() releases one frame at a time
+ * once the previous one has left the wire, so switching between even
+ * parity and the parity error used for CTRL codes never blocks the
+ * main loop, and the uart never holds a backlog of its own.
+ *
+ * Besides the keyboard, local producers (stats printout, pastes, macros)
+ * inject text through job lanes. A job references its data by pointer
+ * and length, so thousands of characters are submitted with one call
+ * and without a copy. Keyboard frames always go first, then the lanes
+ * in order of priority. A full lane rejects new jobs (backpressure) and
+ * every job gets a ticket that tells its producer when the last frame
+ * has been handed to the wire.
+ *
+ * With MBC_TARGETS above one, every MBC has its own queues and pacing.
+ * Frames and jobs go to the targets selected when they are queued, so
+ * switching targets never moves or repeats what is already waiting. In
+ * broadcast mode a frame is only accepted if every target has room for
+ * it, which keeps the machines in step at the pace of the slowest one.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#if FRAME_QUEUE_SIZE > 128 || (FRAME_QUEUE_SIZE & (FRAME_QUEUE_SIZE - 1))
+#error "FRAME_QUEUE_SIZE has to be a power of two, at most 128"
+#endif
+#if JOB_QUEUE_SIZE > 128 || (JOB_QUEUE_SIZE & (JOB_QUEUE_SIZE - 1))
+#error "JOB_QUEUE_SIZE has to be a power of two, at most 128"
+#endif
+
+// frame flags
+#define FRAME_ODD_PARITY 0x01  // send with a parity error (CTRL codes)
+#define FRAME_TIMED 0x02       // origin is a keystroke, count its latency
+#define FRAME_SEQUENCE 0x04    // entry refers to a SeqFrame sequence in PROGMEM
+
+// one frame of a sequence in flash
+struct SeqFrame {
+  uint8_t code;   // byte on the wire
+  uint8_t flags;  // FRAME_ODD_PARITY or 0
+};
+
+// frames of a sequence: a CTRL code is the lower case letter with a
+// parity error, see writeWithParityError()
+#define SEQ_CTRL(c) \
+  { c, FRAME_ODD_PARITY }
+#define SEQ_KEY(c) \
+  { c, 0 }
+
+// An entry is either a single frame or, with FRAME_SEQUENCE, a reference
+// to frames in flash. Sequences are sent straight from flash, so a key
+// emitting five frames costs at most two queue entries and no copy. A
+// sequence entry is never FRAME_TIMED, its pointer takes the origin's
+// place.
+struct MbcFrame {
+  uint8_t code;           // byte on the wire, frames left for a sequence
+  uint8_t flags;          // FRAME_* flags
+  union {
+    uint16_t origin;      // millis() of the keystroke, if FRAME_TIMED
+    const SeqFrame* seq;  // next frame, if FRAME_SEQUENCE
+  };
+};
+
+// queue entries one key may need, a timed sequence takes two
+#define KEY_FRAME_ENTRIES 2
+
+// injection lanes, in order of priority
+#define LANE_HIGH 0  // interactive producers, e.g. macros
+#define LANE_LOW 1   // bulk producers, e.g. pastes and printouts
+#define JOB_LANES 2
+
+// job flags
+#define JOB_PROGMEM 0x01  // data lives in flash
+
+struct MbcJob {
+  const uint8_t* data;  // next byte to send
+  uint16_t length;      // bytes left
+  uint8_t flags;        // JOB_* flags
+  uint16_t ticket;      // ticket handed to the producer
+};
+
+// mbcSelectTarget(): all targets at once
+#define MBC_BROADCAST 0xFF
+
+/**
+ * @brief Open the serial line to the MBC
+ */
+void outputBegin();
+
+/**
+ * @brief Select the MBC that frames and jobs queued from now on go to
+ *
+ * @param target 0 .. MBC_TARGETS - 1 or MBC_BROADCAST
+ */
+void mbcSelectTarget(uint8_t target);
+
+/**
+ * @return The selected target or MBC_BROADCAST
+ */
+uint8_t mbcTarget();
+
+/**
+ * @brief Queue a frame for the MBC
+ *
+ * @param code The character code to be sent
+ * @param flags FRAME_* flags, e.g. FRAME_ODD_PARITY
+ * @param origin Time of the keystroke causing the frame, see FRAME_TIMED
+ * @return false if the queue is full
+ */
+bool mbcEnqueue(uint8_t code, uint8_t flags, uint16_t origin = 0);
+
+/**
+ * @brief Queue a sequence of frames stored in flash
+ *
+ * The first frame of a timed sequence, the one whose latency is
+ * counted, is queued as a frame of its own, so the sequence needs two
+ * entries then. A sequence that does not fit is not counted as
+ * discarded, the caller may try again.
+ *
+ * @param seq Frames in PROGMEM, each with its own parity
+ * @param length Number of frames, at least one
+ * @param flags FRAME_TIMED or 0
+ * @param origin Time of the keystroke causing the sequence
+ * @return false if the queue is full or length is 0
+ */
+bool mbcEnqueueSequence(const SeqFrame* seq, uint8_t length, uint8_t flags, uint16_t origin);
+
+/**
+ * @return Number of entries the output queue of every selected target
+ *         can still accept
+ */
+uint8_t frameQueueFree();
+
+/**
+ * @brief Submit a block of codes to be sent with even parity
+ *
+ * The data is not copied; it has to stay valid until the job is done.
+ *
+ * @param lane LANE_HIGH or LANE_LOW
+ * @param data Codes to send, in RAM or in flash (JOB_PROGMEM)
+ * @param length Number of codes
+ * @param flags JOB_* flags
+ * @param ticket Receives the ticket to poll with mbcJobDone()
+ * @return false if the lane is full; submit again later
+ */
+bool mbcSubmit(uint8_t lane, const uint8_t* data, uint16_t length,
+               uint8_t flags, uint16_t* ticket);
+
+/**
+ * @return true once the last frame of the job and of all earlier jobs of
+ *         the lane has been sent, on every target
+ */
+bool mbcJobDone(uint8_t lane, uint16_t ticket);
+
+/**
+ * @return true if no frame or job is waiting for the wire
+ */
+bool outputIdle();
+
+/**
+ * @brief Release the next frame if the line is ready for it
+ *
+ * Call on every pass through loop(). Never blocks.
+ */
+void serviceOutput();
+
+/**
+ * @brief Print target collecting one line of text in RAM
+ *
+ * Used to format text that is then submitted as a job. Characters
+ * beyond the buffer's size are dropped.
+ */
+class TextBuffer : public Print {
+public:
+  size_t write(uint8_t c) {
+    if (length < sizeof(data)) {
+      data[length++] = c;
+    }
+    return 1;
+  }
+  using Print::write;
+  void clear() {
+    length = 0;
+  }
+
+  uint8_t data[TEXT_BUFFER_SIZE];
+  uint8_t length = 0;
+};
+
+#endif
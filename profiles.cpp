@@ -0,0 +1,134 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file profiles.cpp
+ * @brief Per-application key mappings emitting frame sequences
+ */
+
+#include "profiles.h"
+#include "output.h"
+#include "stats.h"
+#include <PS2KeyAdvanced.h>
+
+// modifiers that take part in a match, lock states are ignored
+#define PROFILE_KEY_MASK (0xFF | PS2_CTRL | PS2_ALT | PS2_ALT_GR | PS2_SHIFT)
+
+struct KeyMapping {
+  uint16_t key;         // key code and modifiers, see PROFILE_KEY_MASK
+  const SeqFrame* seq;  // frames in PROGMEM
+  uint8_t length;       // number of frames
+};
+
+struct Profile {
+  const KeyMapping* mappings;  // in PROGMEM
+  uint8_t count;
+};
+
+#define MAPPING(key, seq) \
+  { key, seq, sizeof(seq) / sizeof(SeqFrame) }
+
+// ---------------------------------------------------
+// WordStar
+// ---------------------------------------------------
+// ^C on the MBC is a plain 0x03, see processWithControl()
+static const SeqFrame wsUp[] PROGMEM = { SEQ_CTRL('e') };
+static const SeqFrame wsDown[] PROGMEM = { SEQ_CTRL('x') };
+static const SeqFrame wsLeft[] PROGMEM = { SEQ_CTRL('s') };
+static const SeqFrame wsRight[] PROGMEM = { SEQ_CTRL('d') };
+static const SeqFrame wsWordLeft[] PROGMEM = { SEQ_CTRL('a') };
+static const SeqFrame wsWordRight[] PROGMEM = { SEQ_CTRL('f') };
+static const SeqFrame wsPgUp[] PROGMEM = { SEQ_CTRL('r') };
+static const SeqFrame wsPgDn[] PROGMEM = { SEQ_KEY(0x03) };
+static const SeqFrame wsHome[] PROGMEM = { SEQ_CTRL('q'), SEQ_KEY('s') };
+static const SeqFrame wsEnd[] PROGMEM = { SEQ_CTRL('q'), SEQ_KEY('d') };
+static const SeqFrame wsTop[] PROGMEM = { SEQ_CTRL('q'), SEQ_KEY('r') };
+static const SeqFrame wsBottom[] PROGMEM = { SEQ_CTRL('q'), SEQ_KEY('c') };
+static const SeqFrame wsDelete[] PROGMEM = { SEQ_CTRL('g') };
+static const SeqFrame wsInsert[] PROGMEM = { SEQ_CTRL('v') };
+static const SeqFrame wsDeleteEol[] PROGMEM = { SEQ_CTRL('q'), SEQ_KEY('y') };
+static const SeqFrame wsSave[] PROGMEM = { SEQ_CTRL('k'), SEQ_KEY('s') };
+static const SeqFrame wsSaveExit[] PROGMEM = { SEQ_CTRL('k'), SEQ_KEY('d') };
+// save and go back to the top of the file
+static const SeqFrame wsSaveTop[] PROGMEM = {
+  SEQ_CTRL('k'), SEQ_KEY('s'), SEQ_CTRL('q'), SEQ_KEY('r'), SEQ_KEY(0x0d)
+};
+
+static const KeyMapping wordStar[] PROGMEM = {
+  MAPPING(PS2_KEY_UP_ARROW, wsUp),
+  MAPPING(PS2_KEY_DN_ARROW, wsDown),
+  MAPPING(PS2_KEY_L_ARROW, wsLeft),
+  MAPPING(PS2_KEY_R_ARROW, wsRight),
+  MAPPING(PS2_KEY_L_ARROW | PS2_CTRL, wsWordLeft),
+  MAPPING(PS2_KEY_R_ARROW | PS2_CTRL, wsWordRight),
+  MAPPING(PS2_KEY_PGUP, wsPgUp),
+  MAPPING(PS2_KEY_PGDN, wsPgDn),
+  MAPPING(PS2_KEY_HOME, wsHome),
+  MAPPING(PS2_KEY_END, wsEnd),
+  MAPPING(PS2_KEY_HOME | PS2_CTRL, wsTop),
+  MAPPING(PS2_KEY_END | PS2_CTRL, wsBottom),
+  MAPPING(PS2_KEY_DELETE, wsDelete),
+  MAPPING(PS2_KEY_INSERT, wsInsert),
+  MAPPING(PS2_KEY_DELETE | PS2_CTRL, wsDeleteEol),
+  MAPPING(PS2_KEY_F2, wsSave),
+  MAPPING(PS2_KEY_F10, wsSaveExit),
+  MAPPING(PS2_KEY_F2 | PS2_SHIFT, wsSaveTop),
+};
+
+static const Profile profiles[PROFILE_COUNT] PROGMEM = {
+  { NULL, 0 },
+  { wordStar, sizeof(wordStar) / sizeof(KeyMapping) },
+};
+
+static uint8_t activeProfile = DEFAULT_PROFILE;
+
+bool profileHandleKey(uint16_t code, uint16_t origin) {
+  const KeyMapping* mapping = (const KeyMapping*)pgm_read_ptr(&profiles[activeProfile].mappings);
+  uint8_t count = pgm_read_byte(&profiles[activeProfile].count);
+  uint16_t key = code & PROFILE_KEY_MASK;
+
+  for (uint8_t i = 0; i < count; i++, mapping++) {
+    if (pgm_read_word(&mapping->key) != key) {
+      continue;
+    }
+    const SeqFrame* seq = (const SeqFrame*)pgm_read_ptr(&mapping->seq);
+    uint8_t length = pgm_read_byte(&mapping->length);
+    // the key is gone once taken from the burst buffer
+    if (!mbcEnqueueSequence(seq, length, FRAME_TIMED, origin)) {
+      stats.framesDiscarded += length;
+    }
+    return true;
+  }
+  return false;
+}
+
+void profileNext() {
+  activeProfile = (activeProfile + 1) % PROFILE_COUNT;
+}
+
+void profileSelect(uint8_t profile) {
+  if (profile < PROFILE_COUNT) {
+    activeProfile = profile;
+  }
+}
+
+uint8_t profileActive() {
+  return activeProfile;
+}
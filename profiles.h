@@ -0,0 +1,67 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file profiles.h
+ * @brief Per-application key mappings emitting frame sequences
+ *
+ * WordStar and other CP/M style programs on the MBC are driven by
+ * control key sequences (^E/^X/^S/^D, ^Q prefixes). A profile maps PC
+ * keys such as Home, End or CTRL-arrows to such sequences. Sequences live
+ * in flash and are queued by reference, each frame with its own parity.
+ *
+ * CTRL-ALT-P switches to the next profile.
+ */
+
+#ifndef PROFILES_H
+#define PROFILES_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define PROFILE_NONE 0      // plain MBC keyboard
+#define PROFILE_WORDSTAR 1  // WordStar cursor and block commands
+#define PROFILE_COUNT 2
+
+/**
+ * @brief Look up a key in the active profile and queue its sequence
+ *
+ * @param code PS2KeyAdvanced key code including status bits
+ * @param origin Time of the keystroke, for latency statistics
+ * @return true if the key is mapped and has been handled
+ */
+bool profileHandleKey(uint16_t code, uint16_t origin);
+
+/**
+ * @brief Switch to the next profile
+ */
+void profileNext();
+
+/**
+ * @brief Switch to a profile by index, ignored if out of range
+ */
+void profileSelect(uint8_t profile);
+
+/**
+ * @return Index of the active profile
+ */
+uint8_t profileActive();
+
+#endif
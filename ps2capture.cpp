@@ -0,0 +1,303 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file ps2capture.cpp
+ * @brief PS/2 receiver timestamping every clock edge with Timer1
+ */
+
+#include "ps2capture.h"
+
+#ifdef PS2_CAPTURE
+
+#include <util/atomic.h>
+#include <PS2KeyAdvanced.h>
+#include "keystate.h"
+#include "seqlock.h"
+#include "stats.h"
+
+// Timer1 runs at F_CPU / 8, one tick is half a microsecond
+#define TICKS_PER_US 2
+
+// The PS/2 clock runs at 10 - 16.7 kHz, i.e. 60 - 100us per bit
+#define PS2_MIN_PERIOD_TICKS (30 * TICKS_PER_US)   // shorter is a glitch
+#define PS2_MAX_PERIOD_TICKS (150 * TICKS_PER_US)  // longer starts a new frame
+
+// raw scan codes from the isr to the main loop, power of two
+#define PS2_RAW_BUFFER_SIZE 16
+
+static_assert(KB_IRQPIN == 8, "PS2_CAPTURE needs the clock on ICP1 (pin 8)");
+
+// receiver state, only touched by the isrs
+static uint16_t lastEdge;
+static uint8_t idleOverflows;  // Timer1 overflows since lastEdge
+static uint16_t frameStart;
+static uint8_t bitCount;
+static uint8_t shift;
+static uint8_t ones;
+
+// received bytes
+static volatile uint8_t rawBuffer[PS2_RAW_BUFFER_SIZE];
+static volatile uint8_t rawHead;
+static uint8_t rawTail;
+
+// counters, written by the isr
+static volatile Ps2CaptureStats isrStats;
+static Seqlock isrStatsSeq;
+
+/**
+ * The 16 bit difference between two edges wraps after one Timer1 period
+ * (32.8ms), so the overflows in between are counted as well. Two of them
+ * end a partial frame right here, without waiting for the next edge.
+ */
+ISR(TIMER1_OVF_vect) {
+  if (bitCount != 0 && ++idleOverflows >= 2) {
+    seqlockWrite(isrStatsSeq);
+    isrStats.resyncs++;
+    bitCount = 0;
+  }
+}
+
+ISR(TIMER1_CAPT_vect) {
+  // any edge may change the counters
+  seqlockWrite(isrStatsSeq);
+  uint16_t now = ICR1;
+  uint8_t data = KB_DATA_PINREG & _BV(KB_DATA_BIT);
+
+  // the capture isr wins over a pending overflow, count it here if it
+  // happened before the edge, i.e. the captured value is small
+  if ((TIFR1 & _BV(TOV1)) && now < 0x8000) {
+    TIFR1 = _BV(TOV1);
+    idleOverflows++;
+  }
+  uint16_t elapsed = now - lastEdge;
+  // a timer period or more since the last edge, the difference wrapped
+  bool idle = idleOverflows > 1 || (idleOverflows == 1 && now >= lastEdge);
+
+  if (bitCount != 0) {
+    if (!idle && elapsed < PS2_MIN_PERIOD_TICKS) {
+      // ignore the edge, the next one is measured from the last good one
+      isrStats.glitches++;
+      return;
+    }
+    if (idle || elapsed > PS2_MAX_PERIOD_TICKS) {
+      // the rest of the frame went missing, this edge starts a new one
+      isrStats.resyncs++;
+      bitCount = 0;
+    }
+  }
+  lastEdge = now;
+  idleOverflows = 0;
+
+  if (bitCount == 0) {
+    // start bit
+    if (data) {
+      isrStats.framingErrors++;
+      return;
+    }
+    frameStart = now;
+    shift = 0;
+    ones = 0;
+    bitCount = 1;
+  } else if (bitCount <= 8) {
+    // data, lsb first
+    shift >>= 1;
+    if (data) {
+      shift |= 0x80;
+      ones++;
+    }
+    bitCount++;
+  } else if (bitCount == 9) {
+    // odd parity
+    if (data) {
+      ones++;
+    }
+    bitCount++;
+  } else {
+    // stop bit
+    bitCount = 0;
+    if (!data) {
+      isrStats.framingErrors++;
+      return;
+    }
+    if (!(ones & 1)) {
+      isrStats.parityErrors++;
+      return;
+    }
+    // ten clock periods from start to stop bit
+    isrStats.period = (now - frameStart) / 10;
+    isrStats.frames++;
+
+    uint8_t head = rawHead;
+    if ((uint8_t)(head - rawTail) >= PS2_RAW_BUFFER_SIZE) {
+      isrStats.overruns++;
+      return;
+    }
+    rawBuffer[head & (PS2_RAW_BUFFER_SIZE - 1)] = shift;
+    rawHead = head + 1;
+  }
+}
+
+void ps2CaptureBegin() {
+  pinMode(KB_IRQPIN, INPUT_PULLUP);
+  pinMode(KB_DATAPIN, INPUT_PULLUP);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // normal mode, noise canceler, falling edge, clk/8
+    TCCR1A = 0;
+    TCCR1B = _BV(ICNC1) | _BV(CS11);
+    TIFR1 = _BV(ICF1) | _BV(TOV1);
+    TIMSK1 = _BV(ICIE1) | _BV(TOIE1);
+    bitCount = 0;
+    idleOverflows = 0;
+  }
+}
+
+// ---------------------------------------------------
+// Set 2 scan codes to PS2_KEY_* codes
+// ---------------------------------------------------
+static const uint8_t set2Keys[] PROGMEM = {
+  0, PS2_KEY_F9, 0, PS2_KEY_F5, PS2_KEY_F3, PS2_KEY_F1, PS2_KEY_F2, PS2_KEY_F12,           // 00
+  0, PS2_KEY_F10, PS2_KEY_F8, PS2_KEY_F6, PS2_KEY_F4, PS2_KEY_TAB, PS2_KEY_SINGLE, 0,      // 08
+  0, PS2_KEY_L_ALT, PS2_KEY_L_SHIFT, 0, PS2_KEY_L_CTRL, PS2_KEY_Q, PS2_KEY_1, 0,           // 10
+  0, 0, PS2_KEY_Z, PS2_KEY_S, PS2_KEY_A, PS2_KEY_W, PS2_KEY_2, 0,                          // 18
+  0, PS2_KEY_C, PS2_KEY_X, PS2_KEY_D, PS2_KEY_E, PS2_KEY_4, PS2_KEY_3, 0,                  // 20
+  0, PS2_KEY_SPACE, PS2_KEY_V, PS2_KEY_F, PS2_KEY_T, PS2_KEY_R, PS2_KEY_5, 0,              // 28
+  0, PS2_KEY_N, PS2_KEY_B, PS2_KEY_H, PS2_KEY_G, PS2_KEY_Y, PS2_KEY_6, 0,                  // 30
+  0, 0, PS2_KEY_M, PS2_KEY_J, PS2_KEY_U, PS2_KEY_7, PS2_KEY_8, 0,                          // 38
+  0, PS2_KEY_COMMA, PS2_KEY_K, PS2_KEY_I, PS2_KEY_O, PS2_KEY_0, PS2_KEY_9, 0,              // 40
+  0, PS2_KEY_DOT, PS2_KEY_DIV, PS2_KEY_L, PS2_KEY_SEMI, PS2_KEY_P, PS2_KEY_MINUS, 0,       // 48
+  0, 0, PS2_KEY_APOS, 0, PS2_KEY_OPEN_SQ, PS2_KEY_EQUAL, 0, 0,                             // 50
+  PS2_KEY_CAPS, PS2_KEY_R_SHIFT, PS2_KEY_ENTER, PS2_KEY_CLOSE_SQ, 0, PS2_KEY_BACK, 0, 0,  // 58
+  0, 0, 0, 0, 0, 0, PS2_KEY_BS, 0,                                                         // 60
+  0, PS2_KEY_KP1, 0, PS2_KEY_KP4, PS2_KEY_KP7, 0, 0, 0,                                    // 68
+  PS2_KEY_KP0, PS2_KEY_KP_DOT, PS2_KEY_KP2, PS2_KEY_KP5,                                   // 70
+  PS2_KEY_KP6, PS2_KEY_KP8, PS2_KEY_ESC, PS2_KEY_NUM,                                      // 74
+  PS2_KEY_F11, PS2_KEY_KP_PLUS, PS2_KEY_KP3, PS2_KEY_KP_MINUS,                             // 78
+  PS2_KEY_KP_TIMES, PS2_KEY_KP9, PS2_KEY_SCROLL, 0,                                        // 7C
+  0, 0, 0, PS2_KEY_F7,                                                                     // 80
+};
+
+// keys prefixed with E0: scan code, key
+static const uint8_t set2ExtendedKeys[][2] PROGMEM = {
+  { 0x11, PS2_KEY_R_ALT },
+  { 0x14, PS2_KEY_R_CTRL },
+  { 0x1F, PS2_KEY_L_GUI },
+  { 0x27, PS2_KEY_R_GUI },
+  { 0x2F, PS2_KEY_MENU },
+  { 0x4A, PS2_KEY_KP_DIV },
+  { 0x5A, PS2_KEY_KP_ENTER },
+  { 0x69, PS2_KEY_END },
+  { 0x6B, PS2_KEY_L_ARROW },
+  { 0x6C, PS2_KEY_HOME },
+  { 0x70, PS2_KEY_INSERT },
+  { 0x71, PS2_KEY_DELETE },
+  { 0x72, PS2_KEY_DN_ARROW },
+  { 0x74, PS2_KEY_R_ARROW },
+  { 0x75, PS2_KEY_UP_ARROW },
+  { 0x7A, PS2_KEY_PGDN },
+  { 0x7C, PS2_KEY_PRTSCR },
+  { 0x7D, PS2_KEY_PGUP },
+};
+
+// decoder state
+static bool breakPrefix = false;
+static bool extendedPrefix = false;
+static uint8_t skipBytes = 0;
+
+static uint8_t extendedKey(uint8_t scanCode) {
+  for (uint8_t i = 0; i < sizeof(set2ExtendedKeys) / sizeof(set2ExtendedKeys[0]); i++) {
+    if (pgm_read_byte(&set2ExtendedKeys[i][0]) == scanCode) {
+      return pgm_read_byte(&set2ExtendedKeys[i][1]);
+    }
+  }
+  // includes the fake shifts around print screen and friends
+  return 0;
+}
+
+/**
+ * @return Key code for the scan code, 0 if it only changed the state
+ */
+static uint16_t decode(uint8_t scanCode) {
+  if (skipBytes) {
+    skipBytes--;
+    return 0;
+  }
+  switch (scanCode) {
+    case 0xF0:
+      breakPrefix = true;
+      return 0;
+    case 0xE0:
+      extendedPrefix = true;
+      return 0;
+    case 0xE1:
+      // pause has no break code: E1 14 77 E1 F0 14 F0 77
+      skipBytes = 7;
+      return keyEvent(PS2_KEY_PAUSE, true);
+    case 0x00:
+    case 0xFF:
+      // the keyboard's own buffer overflowed
+      stats.ps2KeyboardOverruns++;
+      return 0;
+    case 0xAA:  // self test passed
+    case 0xFA:  // acknowledge
+    case 0xEE:  // echo
+    case 0xFE:  // resend
+      return 0;
+    default:
+      break;
+  }
+
+  uint8_t key;
+  if (extendedPrefix) {
+    key = extendedKey(scanCode);
+  } else if (scanCode < sizeof(set2Keys)) {
+    key = pgm_read_byte(&set2Keys[scanCode]);
+  } else {
+    key = 0;
+  }
+  bool make = !breakPrefix;
+  breakPrefix = false;
+  extendedPrefix = false;
+
+  return key ? keyEvent(key, make) : 0;
+}
+
+bool ps2CaptureRead(uint16_t* code) {
+  while (rawTail != rawHead) {
+    uint8_t scanCode = rawBuffer[rawTail & (PS2_RAW_BUFFER_SIZE - 1)];
+    rawTail++;
+    *code = decode(scanCode);
+    if (*code) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ps2CaptureStats() {
+  uint8_t seq;
+  do {
+    seq = seqlockReadBegin(isrStatsSeq);
+    stats.ps2Capture = *(Ps2CaptureStats*)&isrStats;
+  } while (seqlockReadRetry(isrStatsSeq, seq));
+}
+
+#endif
@@ -0,0 +1,70 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file ps2capture.h
+ * @brief PS/2 receiver timestamping every clock edge with Timer1
+ *
+ * On long or noisy cables spurious clock edges corrupt frames. With
+ * PS2_CAPTURE enabled, the PS/2 clock is wired to Timer1's input
+ * capture pin (ICP1, Arduino pin 8) instead of going through
+ * PS2KeyAdvanced. Every falling edge is timestamped by the hardware,
+ * which allows the receiver to:
+ * - reject edges that follow the previous one too closely (glitches)
+ * - resynchronise when an edge comes too late for the current frame
+ * - measure the keyboard's actual clock rate
+ *
+ * The capture ISR reads the data line straight from the port register
+ * and only shifts bits; set 2 scan codes are decoded in the main loop
+ * into the same codes PS2KeyAdvanced delivers (see keystate.h).
+ *
+ * The receiver does not send commands to the keyboard, so the keyboard
+ * LEDs are not updated and its typematic rate cannot be set.
+ */
+
+#ifndef PS2CAPTURE_H
+#define PS2CAPTURE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef PS2_CAPTURE
+
+/**
+ * @brief Configure the pins and Timer1's input capture
+ */
+void ps2CaptureBegin();
+
+/**
+ * @brief Decode received scan codes into key codes
+ *
+ * @param code Receives the next key code
+ * @return false if no complete key is available
+ */
+bool ps2CaptureRead(uint16_t* code);
+
+/**
+ * @brief Copy the receiver's counters into the stats
+ */
+void ps2CaptureStats();
+
+#endif
+
+#endif
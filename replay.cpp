@@ -0,0 +1,270 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file replay.cpp
+ * @brief Trace decoder, tick driven key release and frame comparison
+ */
+
+#include "replay.h"
+
+#ifdef REPLAY
+
+#include <util/atomic.h>
+#include "output.h"
+#include "stats.h"
+#include "tick.h"
+#include "trace.h"
+
+// keys decoded ahead of time and frames expected (powers of two)
+#define REPLAY_AHEAD 8
+#define REPLAY_EXPECT 16
+
+// time the output gets after the last key before missing frames count
+#define REPLAY_SETTLE_MS 500
+// longer pauses in the trace are shortened to this
+#define REPLAY_PAUSE_MAX_MS 60000UL
+
+struct ScheduledKey {
+  uint32_t due;   // tick at which the key is released
+  uint16_t code;  // PS2KeyAdvanced code
+};
+
+// written by the main loop up to scheduleHead, released by the isr up
+// to releaseHead, taken by the main loop up to scheduleTail
+static volatile ScheduledKey schedule[REPLAY_AHEAD];
+static volatile uint8_t scheduleHead;
+static volatile uint8_t releaseHead;
+static uint8_t scheduleTail;
+static volatile uint32_t ticks;
+
+// frames still expected, code in the low byte, 0x100 for odd parity
+static uint16_t expected[REPLAY_EXPECT];
+static uint8_t expectHead;
+static uint8_t expectTail;
+
+// trace being played
+static const uint8_t* data;
+static uint16_t length;
+static uint16_t position;
+static bool progmem;
+static bool running = false;
+static bool keySeen;
+// tick of the last record, and the fraction of a tick left over
+static uint32_t recordTick;
+static uint16_t tickRemainder;
+static uint16_t settleStart;
+
+#ifdef HOST_LINK
+// trace uploaded by the host
+static uint8_t uploaded[REPLAY_BUFFER_SIZE];
+static uint16_t uploadedLength = 0;
+#endif
+
+static uint8_t readByte() {
+  uint8_t b = progmem ? pgm_read_byte(data + position) : data[position];
+  position++;
+  return b;
+}
+
+static uint32_t readVarint() {
+  uint32_t value = 0;
+  uint8_t shift = 0;
+  uint8_t b;
+  do {
+    b = position < length ? readByte() : 0;
+    value |= (uint32_t)(b & 0x7F) << shift;
+    shift += 7;
+  } while ((b & 0x80) && shift < 32);
+  return value;
+}
+
+void replayTick() {
+  ticks++;
+  uint8_t head = releaseHead;
+  if (head != scheduleHead &&
+      (int32_t)(ticks - schedule[head & (REPLAY_AHEAD - 1)].due) >= 0) {
+    releaseHead = head + 1;
+  }
+}
+
+bool replayStart(const uint8_t* trace, uint16_t traceLength, bool traceProgmem) {
+  if (running) {
+    return false;
+  }
+  data = trace;
+  length = traceLength;
+  position = 0;
+  progmem = traceProgmem;
+  keySeen = false;
+  tickRemainder = 0;
+  expectHead = expectTail = 0;
+  scheduleTail = 0;
+  tickBegin();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    scheduleHead = releaseHead = 0;
+    recordTick = ticks;
+  }
+  stats.replayKeys = 0;
+  stats.replayFrames = 0;
+  stats.replayDivergences = 0;
+  stats.replayFirstDivergence = 0;
+  running = true;
+  return true;
+}
+
+#ifdef HOST_LINK
+bool replayUpload(const uint8_t* bytes, uint8_t count, bool restart, uint16_t* stored) {
+  if (restart) {
+    uploadedLength = 0;
+  }
+  *stored = uploadedLength;
+  if (count > REPLAY_BUFFER_SIZE - uploadedLength) {
+    return false;
+  }
+  memcpy(uploaded + uploadedLength, bytes, count);
+  uploadedLength += count;
+  *stored = uploadedLength;
+  return true;
+}
+
+bool replayStartUploaded() {
+  return replayStart(uploaded, uploadedLength, false);
+}
+#endif
+
+bool replayBusy() {
+  return running;
+}
+
+bool replayRead(uint16_t* code) {
+  if (scheduleTail == releaseHead) {
+    return false;
+  }
+  *code = schedule[scheduleTail & (REPLAY_AHEAD - 1)].code;
+  scheduleTail++;
+  stats.replayKeys++;
+  return true;
+}
+
+/**
+ * @brief Count a divergence, keeping the details of the first one
+ *
+ * @param want Expected frame, 0xFFFF if none was
+ * @param got Produced frame, 0xFFFF if none was
+ */
+static void diverged(uint16_t want, uint16_t got) {
+  stats.replayDivergences++;
+  if (stats.replayFirstDivergence == 0) {
+    stats.replayFirstDivergence = stats.replayFrames + 1;
+    stats.replayExpected = want;
+    stats.replayActual = got;
+  }
+}
+
+void replayFrame(uint8_t code, uint8_t flags) {
+  if (!running) {
+    return;
+  }
+  uint16_t got = code | (flags & FRAME_ODD_PARITY ? 0x100 : 0);
+  if (expectTail == expectHead) {
+    diverged(0xFFFF, got);
+  } else {
+    uint16_t want = expected[expectTail & (REPLAY_EXPECT - 1)];
+    expectTail++;
+    if (want != got) {
+      diverged(want, got);
+    }
+  }
+  stats.replayFrames++;
+}
+
+/**
+ * @brief Decode the next record if there is room for what it produces
+ *
+ * @return false if nothing was decoded
+ */
+static bool decodeRecord() {
+  if (position >= length ||
+      (uint8_t)(scheduleHead - scheduleTail) >= REPLAY_AHEAD ||
+      (uint8_t)(expectHead - expectTail) >= REPLAY_EXPECT) {
+    return false;
+  }
+  uint8_t header = readByte();
+  uint32_t delta = header >> 2;
+  if (delta == TRACE_DELTA_VARINT) {
+    delta = readVarint();
+  }
+  // milliseconds to ticks, carrying the remainder
+  uint32_t scaled = min(delta, REPLAY_PAUSE_MAX_MS) * TICK_HZ + tickRemainder;
+  recordTick += scaled / 1000;
+  tickRemainder = scaled % 1000;
+
+  switch (header & 3) {
+    case TRACE_SYNC:
+      // absolute time, the replay only uses the deltas
+      readVarint();
+      break;
+    case TRACE_KEY: {
+      uint16_t code = readByte();
+      code |= readVarint() << 8;
+      volatile ScheduledKey& key = schedule[scheduleHead & (REPLAY_AHEAD - 1)];
+      key.code = code;
+      key.due = recordTick;
+      scheduleHead++;
+      keySeen = true;
+      break;
+    }
+    default: {
+      uint16_t frame = readByte() | ((header & 3) == TRACE_FRAME_ODD ? 0x100 : 0);
+      if (keySeen) {
+        expected[expectHead & (REPLAY_EXPECT - 1)] = frame;
+        expectHead++;
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+void replayService() {
+  if (!running) {
+    return;
+  }
+  if (decodeRecord()) {
+    settleStart = millis();
+    return;
+  }
+  // done once every key has been played and the output had time to follow
+  if (position < length || scheduleTail != scheduleHead || !outputIdle()) {
+    settleStart = millis();
+    return;
+  }
+  if ((uint16_t)((uint16_t)millis() - settleStart) < REPLAY_SETTLE_MS) {
+    return;
+  }
+  while (expectTail != expectHead) {
+    diverged(expected[expectTail & (REPLAY_EXPECT - 1)], 0xFFFF);
+    expectTail++;
+  }
+  running = false;
+}
+
+#endif
@@ -0,0 +1,113 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file replay.h
+ * @brief Plays a recorded trace into the MBC and checks the frames
+ *
+ * A trace in the format of trace.h, e.g. dumped from an adapter in the
+ * field, is played back: its keys are fed into the burst buffer with
+ * their original spacing and go through the translation like typed
+ * keys, and its frames are what the translation is expected to
+ * produce. Every frame handed to the MBC line during the replay is
+ * compared with the next expected one; the first divergence and the
+ * number of divergences are kept in the stats.
+ *
+ * Keys are scheduled a few records ahead by the main loop and released
+ * by the Timer2 tick when they are due, so the spacing does not depend
+ * on how long a pass through loop() takes. Frames recorded before the
+ * first key of the trace are skipped, they belong to keys that are not
+ * part of it. Keys typed during a replay show up as divergences. Pauses
+ * longer than a minute are shortened to a minute.
+ *
+ * CTRL-ALT-T plays the trace in replaytrace.h. With HOST_LINK, a trace
+ * can also be uploaded with HOST_MSG_REPLAY and played from RAM.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef REPLAY
+
+/**
+ * @brief Start playing a trace
+ *
+ * The data is not copied; it has to stay valid until the replay ends.
+ *
+ * @param data Trace records, starting with a sync record
+ * @param length Bytes of the trace
+ * @param progmem true if the trace lives in flash
+ * @return false if a replay is already running
+ */
+bool replayStart(const uint8_t* data, uint16_t length, bool progmem);
+
+#ifdef HOST_LINK
+/**
+ * @brief Append part of an uploaded trace to the RAM buffer
+ *
+ * @param restart true to drop what has been uploaded before
+ * @param stored Set to the bytes uploaded so far
+ * @return false if the bytes do not fit into REPLAY_BUFFER_SIZE
+ */
+bool replayUpload(const uint8_t* bytes, uint8_t count, bool restart, uint16_t* stored);
+
+/**
+ * @brief Start playing the uploaded trace
+ *
+ * @return false if a replay is already running
+ */
+bool replayStartUploaded();
+#endif
+
+/**
+ * @return true while a replay is running
+ */
+bool replayBusy();
+
+/**
+ * @brief Take the next key that is due
+ *
+ * @return false if no key is due
+ */
+bool replayRead(uint16_t* code);
+
+/**
+ * @brief Compare a frame handed to the MBC line with the trace
+ *
+ * @param flags FRAME_* flags of the frame
+ */
+void replayFrame(uint8_t code, uint8_t flags);
+
+/**
+ * @brief Decode ahead and finish the replay. Call on every pass through loop().
+ */
+void replayService();
+
+/**
+ * @brief Release keys that are due. Called by the Timer2 interrupt.
+ */
+void replayTick();
+
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file replaytrace.h
+ * @brief Trace played into the MBC with CTRL-ALT-T
+ *
+ * Paste the bytes of a trace dumped with HOST_MSG_TRACE here, see
+ * trace.h for the format. The example types "dir" and RETURN, a key
+ * every 150ms, each followed by the frame it is expected to produce.
+ */
+
+#ifndef REPLAYTRACE_H
+#define REPLAYTRACE_H
+
+#include <Arduino.h>
+
+const uint8_t replayTrace[] PROGMEM = {
+  0x00, 0x00,                          // sync, time 0
+  0x01, 0x44, 0x00,                    // key D
+  0x02, 0x64,                          // frame 'd'
+  0xFD, 0x96, 0x01, 0x49, 0x00,        // 150ms, key I
+  0x02, 0x69,                          // frame 'i'
+  0xFD, 0x96, 0x01, 0x52, 0x00,        // 150ms, key R
+  0x02, 0x72,                          // frame 'r'
+  0xFD, 0x96, 0x01, 0x1E, 0x01,        // 150ms, key ENTER (function key)
+  0x02, 0x0D,                          // frame CR
+};
+
+#endif
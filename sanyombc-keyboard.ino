@@ -32,27 +32,69 @@
  * - Supports special key combinations (e.g., CTRL-ALT-DEL for system reset)
  * - Implements a capture mode for entering arbitrary hex codes
  * - Configurable debug mode for development and troubleshooting
+ * - Burst buffer and paced output for barcode wedges and other fast devices
  *
  * Special Key Combinations:
  * - CTRL-ALT-DEL: Sends a reset signal to the MBC
  * - CTRL-ALT-A: Enables capture mode for entering arbitrary hex codes
+ * - CTRL-ALT-S: Types the adapter's counters into the MBC (not with TINY)
+ * - CTRL-ALT-P: Switches to the next key mapping profile (e.g. WordStar)
+ * - CTRL-ALT-= / CTRL-ALT--: Faster / slower key repeat
+ * - CTRL-ALT-L / CTRL-ALT-R: Line mode on/off / send the last line again
+ *   (with LINE_EDIT)
+ * - CTRL-ALT-1 .. CTRL-ALT-n: Type into MBC n, CTRL-ALT-0 into all of them
+ *   (with MBC_TARGETS > 1)
+ * - CTRL-ALT-T: Plays the trace in replaytrace.h into the MBC (with REPLAY)
  *
  * @note Currently supports US-American keyboard layout only.
  * @date September-2024
  * @
  */
 
-// You can activate debug mode that outputs to the serial console
-// For debugging and plugging the arduino directly into a
-// computer's usb/serial. Don't enable in final firmare.
-// #define DEBUG 1 // detail keystroke and program info
-// #define OUTPUT_DEBUG 1 // just outputs the final hex characters readable
+// build configuration, pins and feature switches
+#include "config.h"
 
 #include <PS2KeyAdvanced.h>
 #include <PS2KeyMap.h>
 
 // sanyo scan codes
 #include "scancodes.h"
+// paced output to the MBC
+#include "output.h"
+// burst buffer between the PS2 library and the translator
+#include "keybuffer.h"
+// counters
+#include "stats.h"
+// mbc power and reset sensing
+#include "mbcsense.h"
+// per application key mappings
+#include "profiles.h"
+// long running activities as coroutines
+#include "tasks.h"
+// input capture ps2 receiver
+#include "ps2capture.h"
+// key repeat rate of the keyboard
+#include "typematic.h"
+// user data in flash
+#include "flashstore.h"
+// binary protocol to a host computer
+#include "hostlink.h"
+// key matrix input backend
+#include "matrix.h"
+// key translation and its self-test
+#include "translate.h"
+#include "selftest.h"
+// command lines edited on the adapter
+#include "lineedit.h"
+// wire timing measured through a tx loopback
+#include "loopback.h"
+// recorded traces played back into the mbc
+#include "replay.h"
+#include "replaytrace.h"
+// boot prompts answered after a reset
+#include "bootscript.h"
+// accelerating key repeat
+#include "autorepeat.h"
 
 // standard stuff
 #include <stdio.h>
@@ -60,23 +102,16 @@
 #include <ctype.h>
 #include <string.h>
 
-// ps2 adapter pins
-const int KB_DATAPIN = 8;  // ps2 data pin
-const int KB_IRQPIN = 3;   // ps2 clxock pin. has to be on 2 or 3 (interrupt pin)
-
-// serial configuration as per MBC-555 specifications
-const int MBC_BAUD = 1200;          // 1200 baud
-const int MBC_SR_CFG = SERIAL_8E2;  // 8 data, 2 stop bits
-
-// output pin for reset
-const int MBC_RESET_PIN = 6;  // reset pin to MBC; pulled to low for reset
-
 // macro
 #define CHECK_BIT(var, pos) ((var) & (1 << (pos))) > 0
 
+#if !defined(PS2_CAPTURE) && !defined(MATRIX)
 PS2KeyAdvanced keyboard;
+#endif
 // character from ps2
 uint16_t currentScanCode;
+// time the character arrived, frames carry it for latency statistics
+uint16_t currentKeyStamp;
 // status codes for pressed keys
 bool isControlPressed;
 bool isAltGrPressed;
@@ -86,6 +121,20 @@ bool isCapsLockOn;
 bool isShiftPressed;
 bool upperCase;
 
+#ifdef FLASH_STORE
+// settings kept in the flash store, restored at startup
+struct Settings {
+  uint8_t repeatCps;
+  uint8_t repeatDelay;
+  uint8_t profile;
+};
+
+// settings changed and not yet saved
+bool settingsDirty = false;
+// time of the last change or failed save
+uint32_t settingsChangedMs;
+#endif
+
 /**
  * @brief Initialize hardware and configure keyboard settings
  *
@@ -101,53 +150,219 @@ void setup() {
   // startup delay
   delay(500);
 
+#ifndef TINY
+  // cost of the task dispatcher, for the stats
+  taskBenchmark();
+#endif
+
+#ifdef FLASH_STORE
+  flashStoreBegin();
+  loadSettings();
+#endif
+
   // setup keyboard
+#if defined(MATRIX)
+  // repeats are generated from repeatCps and repeatDelay
+  matrixBegin();
+#elif defined(PS2_CAPTURE)
+  // break codes and modifier repeats are dropped by the decoder
+  ps2CaptureBegin();
+#else
   keyboard.begin(KB_DATAPIN, KB_IRQPIN);
 
+#ifdef REPEAT_ACCEL
+  // the adapter repeats keys itself and needs to see the releases
+  keyboard.setNoBreak(0);
+#else
   // Disable Break codes (key release) from PS2KeyAdvanced
   keyboard.setNoBreak(1);
+#endif
   // and set no repeat on CTRL, ALT, SHIFT, GUI while outputting
   keyboard.setNoRepeat(1);
+  // repeat at a rate the mbc can take
+  applyTypematic();
+#endif
 
   // output
-  Serial.begin(MBC_BAUD, MBC_SR_CFG);
+  outputBegin();
+  mbcSenseBegin();
+#ifdef REPEAT_ACCEL
+  repeatBegin();
+#endif
+
+#ifdef SELF_TEST
+  selfTest(Serial);
+#endif
 
 #ifdef DEBUG
   Serial.println("\nMBC keyboard translator **** DEBUG MODE ****\n");
 #endif
 }
 
+// key handed to the capture task, see captureTask()
+static uint16_t captureKey;
+// value assembled from the hex digits
+static uint8_t captureValue;
+static uint8_t captureDigits;
+
+/**
+ * @brief Main processing loop
+ *
+ * Moves all available keys into the burst buffer, translates the next
+ * key once the output queue has room for it and releases frames to
+ * the MBC at the pace of the serial line.
+ */
+void loop() {
+  ingestKeys();
+
+  // a key produces at most KEY_FRAME_ENTRIES queue entries (sequences
+  // are queued by reference); longer output is produced by tasks
+  if (keyBufferCount() > 0 && frameQueueFree() >= KEY_FRAME_ENTRIES) {
+    currentScanCode = keyBufferGet(&currentKeyStamp);
+    stats.keysTranslated++;
+    processScanCode();
+  }
+
+  runTasks();
+#ifdef HOST_LINK
+  hostLinkService();
+#endif
+#ifdef TX_LOOPBACK
+  loopbackService();
+#endif
+#ifdef REPLAY
+  replayService();
+#endif
+#ifdef FLASH_STORE
+  if (settingsDirty && !flashStoreBusy() && millis() - settingsChangedMs >= SETTINGS_SAVE_DELAY_MS) {
+    saveSettings();
+  }
+#endif
+  serviceOutput();
+}
+
 /**
- * @brief Convert a hexadecimal string to an integer
+ * @brief Program the keyboard's typematic rate and delay
  *
- * @param hex Pointer to a null-terminated string containing a hex value
- * @return int The integer value of the hex string
+ * Sends the PS/2 Set Typematic Rate/Delay command with the fastest
+ * rate that neither exceeds repeatCps nor the line's capacity. The input
+ * capture receiver cannot send commands, the keyboard keeps its own
+ * setting then. The key matrix reads the setting itself. With
+ * REPEAT_ACCEL the keyboard's repeats are dropped, so it is set to its
+ * slowest rate and longest delay.
+ */
+void applyTypematic() {
+#if !defined(PS2_CAPTURE) && !defined(MATRIX)
+#ifdef REPEAT_ACCEL
+  keyboard.typematic(31, 3);
+#else
+  keyboard.typematic(typematicRate(repeatCps), repeatDelay);
+#endif
+#endif
+}
+
+/**
+ * @brief Note that a setting has changed and should be saved
  */
-int hex_to_int(const char* hex) {
-  int value = 0;
-  sscanf(hex, "%x", &value);
-  return value;
+void settingsChanged() {
+#ifdef FLASH_STORE
+  settingsDirty = true;
+  settingsChangedMs = millis();
+#endif
 }
 
-// buffer to store characters
-static char hexBuffer[10] = "";  // Buffer to store hex characters
-static int bufferIndex = 0;      // Buffer index
-bool captureMode = false;
+#ifdef FLASH_STORE
+/**
+ * @brief Restore the newest settings from the flash store
+ */
+void loadSettings() {
+  FlashRecord record;
+  if (!flashStoreFind(FLASH_REC_SETTINGS, &record) || record.length != sizeof(Settings)) {
+    return;
+  }
+  Settings settings;
+  memcpy_P(&settings, record.data, sizeof(settings));
+  repeatCps = settings.repeatCps;
+  repeatDelay = settings.repeatDelay;
+  profileSelect(settings.profile);
+}
 
 /**
- * @brief Main processing loop
+ * @brief Append the current settings to the flash store
  *
- * Continuously checks for available keyboard input and processes
- * scan codes when they are received.
+ * Called once the settings have not changed for SETTINGS_SAVE_DELAY_MS,
+ * so a burst of adjustments costs one record. Written by the flash task
+ * once the keyboard is quiet. If the store cannot take the record, the
+ * failure is counted and the save is tried again after another delay.
  */
-void loop() {
-  if (keyboard.available()) {
-    // read the next key
-    currentScanCode = keyboard.read();
-    if (currentScanCode > 0) {
-      processScanCode();
+void saveSettings() {
+  Settings settings = {repeatCps, repeatDelay, profileActive()};
+  if (flashStoreAppend(FLASH_REC_SETTINGS, &settings, sizeof(settings))) {
+    settingsDirty = false;
+  } else {
+    stats.settingsSaveFailures++;
+    settingsChangedMs = millis();
+  }
+}
+#endif
+
+/**
+ * @brief Drain the PS2 library into the burst buffer
+ *
+ * The library only holds PS2_LIB_BUFFER_SIZE keys. The backlog found
+ * here is recorded; if it ever reaches the library's size, keys may
+ * have been lost before the adapter saw them. The other input backends
+ * are drained the same way, and so are the keys of a replay that are due.
+ * With REPEAT_ACCEL, releases and the keyboard's own repeats are taken
+ * out here, and the adapter's repeat is added once it is due.
+ */
+void ingestKeys() {
+#ifdef REPLAY
+  uint16_t replayed;
+  while (replayRead(&replayed)) {
+    keyBufferPut(replayed);
+  }
+#endif
+#if defined(MATRIX)
+  uint16_t code;
+  while (matrixRead(&code)) {
+    ingestKey(code);
+  }
+#elif defined(PS2_CAPTURE)
+  uint16_t code;
+  while (ps2CaptureRead(&code)) {
+    ingestKey(code);
+  }
+#else
+  uint8_t backlog = keyboard.available();
+  if (backlog > stats.ps2BacklogPeak) {
+    stats.ps2BacklogPeak = backlog;
+  }
+  while (keyboard.available()) {
+    uint16_t code = keyboard.read();
+    if (code > 0) {
+      ingestKey(code);
     }
   }
+#endif
+#ifdef REPEAT_ACCEL
+  uint16_t repeated;
+  if (repeatRead(&repeated)) {
+    keyBufferPut(repeated);
+  }
+#endif
+}
+
+/**
+ * @brief Move a key from an input backend into the burst buffer
+ */
+void ingestKey(uint16_t code) {
+#ifdef REPEAT_ACCEL
+  if (!repeatFilter(code)) {
+    return;
+  }
+#endif
+  keyBufferPut(code);
 }
 
 
@@ -201,12 +416,153 @@ void processScanCode() {
     return;
   }
 
+#ifndef TINY
+  // type the counters into the mbc
+  if (isControlPressed && isAltPressed && character == PS2_KEY_S) {
+    taskStart(TASK_STATS);
+    return;
+  }
+#endif
+
+  // key repeat rate
+  if (isControlPressed && isAltPressed && (character == PS2_KEY_EQUAL || character == PS2_KEY_MINUS)) {
+    repeatAdjust(character == PS2_KEY_EQUAL);
+    applyTypematic();
+    settingsChanged();
+    return;
+  }
+
+  // next key mapping profile
+  if (isControlPressed && isAltPressed && character == PS2_KEY_P) {
+    profileNext();
+    settingsChanged();
+    return;
+  }
+
+#ifdef LINE_EDIT
+  // local line editing and history
+  if (isControlPressed && isAltPressed && character == PS2_KEY_L) {
+    lineEditToggle();
+    return;
+  }
+  if (isControlPressed && isAltPressed && character == PS2_KEY_R) {
+    lineEditResend();
+    return;
+  }
+#endif
+
+#ifdef REPLAY
+  // play the built-in trace
+  if (isControlPressed && isAltPressed && character == PS2_KEY_T) {
+    replayStart(replayTrace, sizeof(replayTrace), true);
+    return;
+  }
+#endif
+
+#if MBC_TARGETS > 1
+  // switch the mbc the keys go to, or broadcast to all of them
+  if (isControlPressed && isAltPressed && character >= PS2_KEY_0 && character < PS2_KEY_1 + MBC_TARGETS) {
+    mbcSelectTarget(character == PS2_KEY_0 ? MBC_BROADCAST : character - PS2_KEY_1);
+    return;
+  }
+#endif
+
   // ascii mode - capture and release hex
-  if (captureMode) {
-    capture();
+  if (taskRunning(TASK_CAPTURE)) {
+    captureKey = currentScanCode;
+    taskRun(TASK_CAPTURE);
+    return;
+  }
+
+  // capture mode, CTRL-ALT-A again leaves it (see captureTask)
+  if (isControlPressed && isAltPressed && character == PS2_KEY_A) {
+#ifdef DEBUG
+    Serial.println("CAP_ON");
+#endif
+    taskStart(TASK_CAPTURE);
+    // run up to the first wait for a key
+    taskRun(TASK_CAPTURE);
+    return;
+  }
+
+#ifdef LINE_EDIT
+  // typed into the line buffer instead of the mbc
+  if (lineEditKey(currentScanCode)) {
+    return;
+  }
+#endif
+
+  // keys mapped to sequences by the active profile
+  if (profileHandleKey(currentScanCode, currentKeyStamp)) {
     return;
   }
 
+  // regular, control and graph keys
+  SeqFrame frame;
+  if (translateKey(currentScanCode, &frame)) {
+    mbcEnqueue(frame.code, frame.flags | FRAME_TIMED, currentKeyStamp);
+  }
+#ifdef DEBUG
+  else {
+    Serial.print("NOOP");
+  }
+#endif
+}
+
+/**
+ * @brief Write a character code to the serial output
+ *
+ * This function queues the translated character code for the MBC.
+ * In debug mode, the output queue prints it instead of sending it.
+ *
+ * @param code The character code to be sent
+ */
+void w(int code) {
+#ifdef SELF_TEST
+  if (recordFrame(code, 0)) {
+    return;
+  }
+#endif
+  mbcEnqueue(code, FRAME_TIMED, currentKeyStamp);
+}
+
+#ifdef SELF_TEST
+// ---------------------------------------------------
+// Reference translation: the original switch statements, only built
+// for the differential self-test against translateKey()
+// ---------------------------------------------------
+
+// frame written by w() while the reference translation is recorded
+SeqFrame* recordedFrame = NULL;
+uint8_t recordedFrames;
+
+/**
+ * @brief Translate a key with the original switch statements
+ *
+ * Same contract as translateKey(). The frames written through w() and
+ * writeWithParityError() are recorded instead of being queued.
+ */
+bool referenceTranslate(uint16_t code, SeqFrame* frame) {
+  currentScanCode = code;
+  isControlPressed = CHECK_BIT(currentScanCode, 13);
+  isAltGrPressed = CHECK_BIT(currentScanCode, 10);
+  isAltPressed = CHECK_BIT(currentScanCode, 11);
+  isAnyAltPressed = isAltGrPressed || isAltPressed;
+  isCapsLockOn = CHECK_BIT(currentScanCode, 12);
+  isShiftPressed = CHECK_BIT(currentScanCode, 14);
+  upperCase = isCapsLockOn || isShiftPressed;
+
+  recordedFrame = frame;
+  recordedFrames = 0;
+  processReference(currentScanCode & 0xFF);
+  recordedFrame = NULL;
+  return recordedFrames > 0;
+}
+
+/**
+ * @brief Graph, control and regular keys as originally translated
+ */
+void processReference(int character) {
   // altgr is the same as graph on the sanyo (except not sticky)
   if (isAltGrPressed) {
     handleGraphMode(character);
@@ -243,7 +599,7 @@ void processScanCode() {
       w(upperCase ? MBC_BACKTAB : MBC_TAB);
       break;
     case PS2_KEY_BREAK:
-      Serial.write(CTRL_C);  // todo: not sure what break sends
+      w(CTRL_C);  // todo: not sure what break sends
       break;
     case PS2_KEY_ESC:
       w(MBC_ESC);
@@ -527,38 +883,12 @@ void handleGraphMode(int character) {
   }
 }
 
-/**
- * @brief Write a character code to the serial output
- *
- * This function sends the translated character code to the MBC.
- * In debug mode, it prints additional information about the output.
- *
- * @param code The character code to be sent
- */
-void w(int code) {
-#ifdef OUTPUT_DEBUG
-  Serial.print("Output: (");
-  Serial.print(code, HEX);
-  Serial.print(")\n");
-#else
-  Serial.write(code);
-#endif
-}
-
 /** experimental control */
 void processWithControl(int aCharacter) {
 
   switch (aCharacter) {
     case PS2_KEY_A:
-      // enable capture mode if CTRL-ALT-A is pressed
-      if (isControlPressed && isAltPressed) {
-#ifdef DEBUG
-        Serial.println("CAP_ON");
-#endif
-        captureMode = true;
-      } else {
-        writeWithParityError(upperCase ? 'A' : 'a');
-      }
+      writeWithParityError(upperCase ? 'A' : 'a');
       break;
     case PS2_KEY_B:
       writeWithParityError(upperCase ? 'B' : 'b');
@@ -700,100 +1030,125 @@ void processWithControl(int aCharacter) {
 
 /**
  * For certain control characters, a parity error has to be triggered.
- * Yes, the parity bit is part of the scan codes.
+ * Yes, the parity bit is part of the scan codes. The output queue
+ * switches the uart to odd parity for just this frame.
  */
 void writeWithParityError(int c) {
-  // trigger a parity error
-  Serial.end();
-  Serial.begin(MBC_BAUD, SERIAL_8O2);
-
-  w(c);
+  if (recordFrame(c, FRAME_ODD_PARITY)) {
+    return;
+  }
+  mbcEnqueue(c, FRAME_ODD_PARITY | FRAME_TIMED, currentKeyStamp);
+}
 
-  // continue
-  Serial.end();
-  Serial.begin(MBC_BAUD, MBC_SR_CFG);
+/**
+ * @brief Record a frame of the reference translation
+ *
+ * @return false if no recording is active
+ */
+bool recordFrame(uint8_t code, uint8_t flags) {
+  if (recordedFrame == NULL) {
+    return false;
+  }
+  // the reference never writes more than one frame per key
+  if (recordedFrames++ == 0) {
+    recordedFrame->code = code;
+    recordedFrame->flags = flags;
+  }
+  return true;
 }
+#endif
 
 /**
  * @brief Perform a system reset
  *
  * This function triggers a reset of the MBC by pulling the reset
- * line low for a short duration. In debug mode, it only prints
- * a message without actually triggering the reset.
+ * line low for a short duration, see resetTask().
  */
 void reset() {
+  taskStart(TASK_RESET);
+}
+
+/**
+ * @brief Reset pulse to the MBC
+ *
+ * Pulls the reset line low for 500ms without blocking the main loop.
+ * In debug mode, it only prints a message without actually triggering
+ * the reset. With BOOT_SCRIPT, the boot script starts once the line is
+ * released.
+ */
+void resetTask(Task* t) {
+  TASK_BEGIN(t);
 #ifdef DEBUG
   Serial.print("RESET\n");
 #else
   digitalWrite(MBC_RESET_PIN, LOW);
-  delay(500);
+  TASK_DELAY(t, 500);
   digitalWrite(MBC_RESET_PIN, HIGH);
+  // hold the output until the mbc has booted again
+  mbcSenseReset();
+#endif
+#ifdef BOOT_SCRIPT
+  bootScriptStart();
 #endif
+  TASK_END(t);
 }
 
-
 /**
- * @brief Disable capture mode and reset related variables
+ * @brief Value of a hex digit key
  *
- * This function is called when exiting capture mode or when
- * an invalid input is received during capture mode.
+ * @param character PS2 key code without status bits
+ * @return 0-15, or -1 if the key is not a hex digit
  */
-void disableCaptureMode() {
-  bufferIndex = 0;
-  hexBuffer[0] = '\0';
-  captureMode = false;
-#ifdef DEBUG
-  Serial.println("CAP_OFF");
-#endif
+int hexDigit(int character) {
+  if (character >= PS2_KEY_0 && character <= PS2_KEY_9) {
+    return character - PS2_KEY_0;
+  }
+  if (character >= PS2_KEY_A && character <= PS2_KEY_F) {
+    return character - PS2_KEY_A + 10;
+  }
+  return -1;
 }
 
 /**
- * @brief Handle character input during capture mode
+ * @brief Capture mode: two hex digits are released as one character
  *
- * This function processes input when in capture mode, allowing
- * the user to enter arbitrary hex codes. It handles the buffering
- * of input and conversion of hex strings to character codes.
+ * Started by CTRL-ALT-A. processScanCode() hands every key to the task
+ * through captureKey and runs it right away. CTRL-ALT-A again leaves
+ * capture mode, any other non hex key sends '?' and leaves it as well.
  */
-void capture() {
+void captureTask(Task* t) {
+  int digit;
 
-  int character = currentScanCode & 0xFF;
+  TASK_BEGIN(t);
+  captureValue = 0;
+  for (captureDigits = 0; captureDigits < 2; captureDigits++) {
+    captureKey = 0;
+    TASK_WAIT_UNTIL(t, captureKey != 0);
 
-  // toggle off if CTRL-ALT-A pressed again
-  if (character == PS2_KEY_A && isControlPressed && isAltPressed) {
-    captureMode = false;
+    // toggle off if CTRL-ALT-A pressed again
+    if ((captureKey & 0xFF) == PS2_KEY_A && isControlPressed && isAltPressed) {
 #ifdef DEBUG
-    Serial.println("CAP_OFF");
+      Serial.println("CAP_OFF");
 #endif
-    return;
-  }
-
-  // Check if character is a valid hexadecimal character, if so, save it to the buffer
-  if (isxdigit(character)) {
-    if (bufferIndex < sizeof(hexBuffer) - 1) {
-      hexBuffer[bufferIndex++] = character;
-      hexBuffer[bufferIndex] = '\0';  // Null terminate the buffer
+      TASK_EXIT(t);
     }
-  } else {
+
+    digit = hexDigit(captureKey & 0xFF);
+    if (digit < 0) {
 #ifdef DEBUG
-    Serial.println("non hex character");
+      Serial.println("non hex character");
 #endif
-    Serial.print('?');
-    // Reset the buffer, disable capture mode
-    disableCaptureMode();
-    return;
+      w('?');
+      TASK_EXIT(t);
+    }
+    captureValue = (captureValue << 4) | digit;
   }
 
-  // release buffer if it has 2 characters
-  if (bufferIndex > 1) {
-    // release buffer
 #ifdef DEBUG
-    Serial.print("flushing capture buffer (");
-    Serial.print(hexBuffer);
-    Serial.println(")");
+  Serial.print("flushing capture buffer (");
+  Serial.print(captureValue, HEX);
+  Serial.println(")");
 #endif
-    int hex_value = hex_to_int(hexBuffer);  // Convert hex string to int
-    w(hex_value);                           // Output the integer value
-    // Reset the buffer, disable capture mode
-    disableCaptureMode();
-  }
-}
\ No newline at end of file
+  w(captureValue);
+  TASK_END(t);
+}
@@ -0,0 +1,129 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file selftest.cpp
+ * @brief Exhaustive comparison of translateKey() with the reference
+ */
+
+#include "selftest.h"
+
+#ifdef SELF_TEST
+
+#include <PS2KeyAdvanced.h>
+#include "translate.h"
+
+typedef bool (*TranslateFn)(uint16_t code, SeqFrame* frame);
+
+// An intended difference: the key translated to reference by the
+// original code and to candidate by translateKey(), with any status bits
+struct ExpectedDifference {
+  uint8_t key;
+  uint8_t reference;
+  uint8_t candidate;
+};
+
+// ends with a key of 0
+static const ExpectedDifference expectedDifferences[] PROGMEM = {
+  // CTRL-I and CTRL-U sent CTRL-J and CTRL-Y
+  {PS2_KEY_I, 'j', 'i'},
+  {PS2_KEY_U, 'y', 'u'},
+  {0, 0, 0},
+};
+
+static bool expected(uint8_t key, uint8_t reference, uint8_t candidate) {
+  for (const ExpectedDifference* d = expectedDifferences; pgm_read_byte(&d->key); d++) {
+    if (pgm_read_byte(&d->key) == key &&
+        pgm_read_byte(&d->reference) == reference &&
+        pgm_read_byte(&d->candidate) == candidate) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void printFrame(Print& out, bool sent, const SeqFrame& frame) {
+  if (!sent) {
+    out.print(F("--"));
+    return;
+  }
+  out.print(frame.code, HEX);
+  if (frame.flags & FRAME_ODD_PARITY) {
+    out.print(F(" odd"));
+  }
+}
+
+/**
+ * @return Cycles per key for translating every code
+ */
+static uint16_t measure(TranslateFn translate) {
+  SeqFrame frame;
+  unsigned long start = micros();
+  uint16_t code = 0;
+  do {
+    translate(code, &frame);
+  } while (++code != 0);
+  // 65536 keys
+  return (micros() - start) * clockCyclesPerMicrosecond() >> 16;
+}
+
+uint16_t selfTest(Print& out) {
+  uint16_t unexpected = 0;
+  uint16_t whitelisted = 0;
+  uint16_t code = 0;
+
+  do {
+    SeqFrame reference = {0, 0};
+    SeqFrame candidate = {0, 0};
+    bool referenceSent = referenceTranslate(code, &reference);
+    bool candidateSent = translateKey(code, &candidate);
+    if (referenceSent == candidateSent &&
+        (!referenceSent || (reference.code == candidate.code && reference.flags == candidate.flags))) {
+      continue;
+    }
+    if (referenceSent && candidateSent && reference.flags == candidate.flags &&
+        expected(code & 0xFF, reference.code, candidate.code)) {
+      whitelisted++;
+      continue;
+    }
+    unexpected++;
+    out.print(F("diff "));
+    out.print(code, HEX);
+    out.print(F(": "));
+    printFrame(out, referenceSent, reference);
+    out.print(F(" -> "));
+    printFrame(out, candidateSent, candidate);
+    out.print('\n');
+  } while (++code != 0);
+
+  out.print(F("self-test: "));
+  out.print(unexpected);
+  out.print(F(" unexpected, "));
+  out.print(whitelisted);
+  out.print(F(" expected differences\n"));
+  out.print(F("cycles/key reference "));
+  out.print(measure(referenceTranslate));
+  out.print(F(" table "));
+  out.print(measure(translateKey));
+  out.print('\n');
+  return unexpected;
+}
+
+#endif
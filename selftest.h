@@ -0,0 +1,65 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file selftest.h
+ * @brief Differential test of the key translation against its reference
+ *
+ * With SELF_TEST enabled, the adapter runs every one of the 65536
+ * possible PS2KeyAdvanced codes, i.e. every key with every combination
+ * of status bits, through translateKey() and through the original
+ * switch statements kept in the sketch, and prints each key for which
+ * the frames differ. Differences that are intended are listed in
+ * expectedDifferences in selftest.cpp and only counted. Finally the
+ * cycles per key of both translations are printed.
+ *
+ * The results go to the serial port at startup, like DEBUG output.
+ */
+
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "output.h"
+
+#ifdef SELF_TEST
+
+#ifdef HOST_LINK
+#error "SELF_TEST prints to the serial port, disable HOST_LINK"
+#endif
+
+/**
+ * @brief Compare both translations for all codes and print the result
+ *
+ * @return Number of unexpected differences
+ */
+uint16_t selfTest(Print& out);
+
+/**
+ * @brief Translate with the original switch statements
+ *
+ * Implemented by the sketch. Same contract as translateKey().
+ */
+bool referenceTranslate(uint16_t code, SeqFrame* frame);
+
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file seqlock.h
+ * @brief Consistent copies of counters written by interrupts
+ *
+ * Multi-byte counters updated by an interrupt can be read half old, half
+ * new on an 8 bit CPU. Instead of masking interrupts for the whole copy,
+ * which delays the PS/2 edge capture and the tick, the interrupt bumps
+ * a sequence number whenever it may have written, and the main loop
+ * copies until the number is the same before and after:
+ *
+ *   uint8_t seq;
+ *   do {
+ *     seq = seqlockReadBegin(statsSeq);
+ *     copy = *(Counters*)&isrCounters;
+ *   } while (seqlockReadRetry(statsSeq, seq));
+ *
+ * An interrupt handler runs to completion before the main loop goes on,
+ * so a single increment is enough, and the writer never waits. A copy
+ * takes a few microseconds; the sequence would have to wrap 256 times
+ * within it to go unnoticed. Interrupts are never masked by the reader.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+
+typedef volatile uint8_t Seqlock;
+
+// keeps the compiler from moving the copy across the sequence reads
+#define SEQLOCK_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/**
+ * @brief Note a write. Call from the interrupt, or with interrupts off.
+ */
+static inline void seqlockWrite(Seqlock& seq) {
+  seq = seq + 1;
+}
+
+/**
+ * @return Sequence number to check the copy against
+ */
+static inline uint8_t seqlockReadBegin(const Seqlock& seq) {
+  uint8_t begin = seq;
+  SEQLOCK_BARRIER();
+  return begin;
+}
+
+/**
+ * @return true if a write happened since seqlockReadBegin() and the
+ *         copy has to be taken again
+ */
+static inline bool seqlockReadRetry(const Seqlock& seq, uint8_t begin) {
+  SEQLOCK_BARRIER();
+  return seq != begin;
+}
+
+#endif
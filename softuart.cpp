@@ -0,0 +1,100 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file softuart.cpp
+ * @brief Tick driven transmitters with per-frame parity
+ */
+
+#include "softuart.h"
+
+#if SOFT_UARTS > 0
+
+#include <util/atomic.h>
+#include "tick.h"
+
+#define SOFT_UART_TICKS_PER_BIT 8
+
+#ifdef TINY
+static const uint8_t txPins[SOFT_UARTS] PROGMEM = {MBC_TX_PIN};
+#else
+static const uint8_t txPins[SOFT_UARTS] PROGMEM = {MBC_SOFT_TX_PINS};
+#endif
+
+// output register and bit of each port, looked up once
+static volatile uint8_t* txPort[SOFT_UARTS];
+static uint8_t txBit[SOFT_UARTS];
+
+// bits still to send, least significant first
+static volatile uint16_t txFrame[SOFT_UARTS];
+static volatile uint8_t txBits[SOFT_UARTS];
+static uint8_t phase = 0;
+
+void softUartBegin() {
+  for (uint8_t port = 0; port < SOFT_UARTS; port++) {
+    uint8_t pin = pgm_read_byte(&txPins[port]);
+    // the line idles high
+    digitalWrite(pin, HIGH);
+    pinMode(pin, OUTPUT);
+    txPort[port] = portOutputRegister(digitalPinToPort(pin));
+    txBit[port] = digitalPinToBitMask(pin);
+    txBits[port] = 0;
+  }
+  tickBegin();
+}
+
+bool softUartIdle(uint8_t port) {
+  return txBits[port] == 0;
+}
+
+void softUartWrite(uint8_t port, uint8_t code, bool odd) {
+  // even parity makes the number of ones including the parity bit even
+  uint8_t parity = odd ? 1 : 0;
+  for (uint8_t b = code; b; b >>= 1) {
+    parity ^= b & 1;
+  }
+  // start bit 0, data, parity, two stop bits
+  uint16_t frame = ((uint16_t)code << 1) | ((uint16_t)parity << 9) | (3 << 10);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    txFrame[port] = frame;
+    txBits[port] = MBC_FRAME_BITS;
+  }
+}
+
+void softUartTick() {
+  if (++phase < SOFT_UART_TICKS_PER_BIT) {
+    return;
+  }
+  phase = 0;
+  for (uint8_t port = 0; port < SOFT_UARTS; port++) {
+    if (txBits[port] == 0) {
+      continue;
+    }
+    if (txFrame[port] & 1) {
+      *txPort[port] |= txBit[port];
+    } else {
+      *txPort[port] &= ~txBit[port];
+    }
+    txFrame[port] >>= 1;
+    txBits[port]--;
+  }
+}
+
+#endif
@@ -0,0 +1,71 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file softuart.h
+ * @brief Transmit-only software uarts for additional MBC targets
+ *
+ * Each additional MBC is driven from a plain output pin. The bits are
+ * timed by the Timer2 tick (see tick.h), one bit every 8 ticks, which
+ * gives 1202 baud, 0.16% off the 1200 baud of the MBC. The parity bit
+ * is computed per frame, so a parity error costs nothing extra here.
+ *
+ * All ports shift their bits at the same tick; a frame starts with the
+ * next bit period after it has been written.
+ */
+
+#ifndef SOFTUART_H
+#define SOFTUART_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#if SOFT_UARTS > 0
+
+// target driven by port 0
+#define SOFT_UART_FIRST (MBC_TARGETS - SOFT_UARTS)
+
+/**
+ * @brief Configure the pins and start the tick
+ */
+void softUartBegin();
+
+/**
+ * @return true once the last frame, including its stop bits, is out
+ */
+bool softUartIdle(uint8_t port);
+
+/**
+ * @brief Start sending a frame: 8 data bits, parity, 2 stop bits
+ *
+ * Only call while the port is idle.
+ *
+ * @param odd true for odd parity, i.e. a parity error for the MBC
+ */
+void softUartWrite(uint8_t port, uint8_t code, bool odd);
+
+/**
+ * @brief Shift out the next bits. Called by the Timer2 interrupt.
+ */
+void softUartTick();
+
+#endif
+
+#endif
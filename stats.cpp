@@ -0,0 +1,461 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file stats.cpp
+ * @brief Adapter counters and their printout
+ */
+
+#include "stats.h"
+#include "output.h"
+#include "tasks.h"
+#include "ps2capture.h"
+#include "typematic.h"
+#include "flashstore.h"
+#include "matrix.h"
+#include "txring.h"
+
+AdapterStats stats;
+
+// symbols provided by the linker and avr-libc's malloc
+extern uint8_t _end;
+extern uint8_t __stack;
+extern uint8_t __heap_start;
+extern char* __brkval;
+
+// paint pattern for unused sram
+#define STACK_CANARY 0xC5
+
+/**
+ * @brief Paint all SRAM between .bss and the top of the stack
+ *
+ * Runs from .init1, before the stack is in use and before .data and
+ * .bss are set up, hence naked and written in assembly.
+ */
+void paintStack(void) __attribute__((naked, used, section(".init1")));
+void paintStack(void) {
+  __asm volatile(
+    "    ldi r30,lo8(_end)\n"
+    "    ldi r31,hi8(_end)\n"
+    "    ldi r24,lo8(0xc5)\n"  // STACK_CANARY
+    "    ldi r25,hi8(__stack)\n"
+    "    rjmp 2f\n"
+    "1:\n"
+    "    st Z+,r24\n"
+    "2:\n"
+    "    cpi r30,lo8(__stack)\n"
+    "    cpc r31,r25\n"
+    "    brlo 1b\n"
+    "    breq 1b\n" ::);
+}
+
+static uint8_t* heapEnd() {
+  return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+
+uint16_t memoryFree() {
+  uint8_t top;
+  return &top - heapEnd();
+}
+
+uint16_t memoryFreeLow() {
+  uint8_t* p = heapEnd();
+  uint16_t count = 0;
+  while (p <= &__stack && *p == STACK_CANARY) {
+    p++;
+    count++;
+  }
+  return count;
+}
+
+void intervalRecord(IntervalStats& interval, uint16_t ms) {
+  if (interval.count == 0 || ms < interval.min) {
+    interval.min = ms;
+  }
+  if (ms > interval.max) {
+    interval.max = ms;
+  }
+  interval.sum += ms;
+  interval.count++;
+}
+
+uint16_t latencyPercentile(uint8_t percent) {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+    total += stats.latency[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  // rank of the sample at the percentile, rounded up
+  uint32_t rank = (total * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < LATENCY_BUCKETS - 1; i++) {
+    seen += stats.latency[i];
+    if (seen >= rank) {
+      return 1U << i;
+    }
+  }
+  return stats.latencyMax;
+}
+
+static void printKeys(Print& out) {
+  out.print(F("keys in "));
+  out.print(stats.keysIngested);
+  out.print(F(" drop "));
+  out.print(stats.keysDropped);
+  out.print(F(" xlat "));
+  out.print(stats.keysTranslated);
+  out.print(F(" ps2pk "));
+  out.print(stats.ps2BacklogPeak);
+  out.print(F(" bufpk "));
+  out.print(stats.keyBufferPeak);
+}
+
+static void printFrames(Print& out) {
+  out.print(F("frames q "));
+  out.print(stats.framesQueued);
+  out.print(F(" sent "));
+  out.print(stats.framesSent);
+  out.print(F(" odd "));
+  out.print(stats.framesOdd);
+  out.print(F(" qpk "));
+  out.print(stats.frameQueuePeak);
+  out.print(F(" jobpk "));
+  out.print(stats.jobQueuePeak);
+}
+
+static void printMemory(Print& out) {
+  out.print(F("mem free "));
+  out.print(memoryFree());
+  out.print(F(" low "));
+  out.print(memoryFreeLow());
+}
+
+static void printJobs(Print& out) {
+  out.print(F("jobs "));
+  out.print(stats.jobsSubmitted);
+  out.print(F(" busy "));
+  out.print(stats.jobsRejected);
+  out.print(F(" frames "));
+  out.print(stats.framesInjected);
+}
+
+static void printMbc(Print& out) {
+  out.print(F("mbc down "));
+  out.print(stats.mbcDownEvents);
+  out.print(F(" held "));
+  out.print(stats.framesHeld);
+  out.print(F(" lost "));
+  out.print(stats.framesDiscarded);
+}
+
+static void printLatency(Print& out) {
+  // percentiles are bucket bounds, i.e. "below n ms"
+  out.print(F("lat p50 "));
+  out.print(latencyPercentile(50));
+  out.print(F(" p90 "));
+  out.print(latencyPercentile(90));
+  out.print(F(" p99 "));
+  out.print(latencyPercentile(99));
+  out.print(F(" max "));
+  out.print(stats.latencyMax);
+}
+
+static void printTasks(Print& out) {
+  out.print(F("task cycles "));
+  out.print(stats.taskDispatchCycles);
+}
+
+static void printInterval(Print& out, const IntervalStats& interval) {
+  out.print(interval.count);
+  out.print('/');
+  out.print(interval.min);
+  out.print('/');
+  out.print(interval.max);
+  out.print('/');
+  out.print(interval.count ? interval.sum / interval.count : 0);
+}
+
+static void printRepeat(Print& out) {
+  // count/min/max/avg in ms
+  out.print(F("rep cps "));
+#ifdef REPEAT_ACCEL
+  // start, peak and skipped repeats of the adapter's own repeat
+  out.print(repeatCps);
+  out.print('-');
+  out.print(stats.repeatPeakCps);
+  out.print(F(" skip "));
+  out.print(stats.repeatSkipped);
+#else
+  out.print(typematicCps(typematicRate(repeatCps)));
+#endif
+  out.print(F(" in "));
+  printInterval(out, stats.repeatIn);
+  out.print(F(" out "));
+  printInterval(out, stats.repeatOut);
+}
+
+#ifdef HOST_LINK
+static void printHost(Print& out) {
+  // decoding cost per byte; 115200 baud deliver a byte every 1389 cycles
+  out.print(F("host rx "));
+  out.print(stats.hostRxBytes);
+  out.print(F(" cyc/b "));
+  out.print(stats.hostRxBytes ? stats.hostParseMicros * clockCyclesPerMicrosecond() / stats.hostRxBytes : 0);
+  out.print(F(" B/s "));
+  out.print(stats.hostRxRate);
+  out.print(F(" pkt "));
+  out.print(stats.hostPacketsIn);
+  out.print('/');
+  out.print(stats.hostPacketsOut);
+  out.print(F(" err "));
+  out.print(stats.hostCrcErrors);
+  out.print('/');
+  out.print(stats.hostFramingErrors);
+  out.print(F(" data "));
+  out.print(stats.hostDataBytes);
+}
+#endif
+
+#ifdef MATRIX
+static void printMatrix(Print& out) {
+  matrixStats();
+  // scans * 1000 would overflow after about an hour
+  uint32_t seconds = millis() / 1000;
+  out.print(F("matrix scans/s "));
+  out.print(seconds ? stats.matrixScans / seconds : 0);
+  out.print(F(" ovr "));
+  out.print(stats.matrixOverruns);
+}
+#endif
+
+#ifdef TRACE
+static void printTrace(Print& out) {
+  out.print(F("trace rec "));
+  out.print(stats.traceRecords);
+  out.print(F(" bytes "));
+  out.print(stats.traceBytes);
+  out.print(F(" b/rec "));
+  // in tenths
+  uint32_t tenths = stats.traceRecords ? stats.traceBytes * 10 / stats.traceRecords : 0;
+  out.print(tenths / 10);
+  out.print('.');
+  out.print(tenths % 10);
+}
+#endif
+
+#ifdef LINE_EDIT
+static void printLineEdit(Print& out) {
+  // keys typed against frames that reached the wire
+  out.print(F("line keys "));
+  out.print(stats.lineKeys);
+  out.print(F(" sent "));
+  out.print(stats.lineFrames);
+}
+#endif
+
+#ifdef BOOT_SCRIPT
+static void printBoot(Print& out) {
+  out.print(F("boot steps "));
+  out.print(stats.bootSteps);
+  out.print(F(" late "));
+  out.print(stats.bootLateMax);
+  out.print(F("ms"));
+}
+#endif
+
+#ifdef REPLAY
+static void printReplay(Print& out) {
+  // first divergence as frame number, expected > produced, in hex
+  out.print(F("replay keys "));
+  out.print(stats.replayKeys);
+  out.print(F(" frames "));
+  out.print(stats.replayFrames);
+  out.print(F(" diff "));
+  out.print(stats.replayDivergences);
+  if (stats.replayFirstDivergence) {
+    out.print(F(" first "));
+    out.print(stats.replayFirstDivergence);
+    out.print(' ');
+    out.print(stats.replayExpected, HEX);
+    out.print('>');
+    out.print(stats.replayActual, HEX);
+  }
+}
+#endif
+
+#ifdef FLASH_STORE
+static void printFlash(Print& out) {
+  out.print(F("flash "));
+  out.print(flashStoreWritable() ? F("free ") : F("read only, free "));
+  out.print(flashStoreFree());
+  out.print(F(" pages "));
+  out.print(stats.flashPageOps);
+  out.print(F(" crc "));
+  out.print(stats.flashCrcErrors);
+  out.print(F(" compacted "));
+  out.print(stats.flashCompactions);
+  out.print(F(" save failed "));
+  out.print(stats.settingsSaveFailures);
+}
+#endif
+
+#ifdef PS2_CAPTURE
+static void printPs2Capture(Print& out) {
+  ps2CaptureStats();
+  out.print(F("ps2 ok "));
+  out.print(stats.ps2Capture.frames);
+  out.print(F(" gl "));
+  out.print(stats.ps2Capture.glitches);
+  out.print(F(" rs "));
+  out.print(stats.ps2Capture.resyncs);
+  out.print(F(" fe "));
+  out.print(stats.ps2Capture.framingErrors);
+  out.print(F(" pe "));
+  out.print(stats.ps2Capture.parityErrors);
+  out.print(F(" ov "));
+  out.print(stats.ps2Capture.overruns + stats.ps2KeyboardOverruns);
+  out.print(F(" hz "));
+  out.print(stats.ps2Capture.period ? 2000000UL / stats.ps2Capture.period : 0);
+}
+#endif
+
+#ifdef TX_RING
+static void printTxRing(Print& out) {
+  // overhead in tenths of a microsecond
+  txRingStats();
+  out.print(F("ring tx "));
+  out.print(stats.txRing.frames);
+  out.print(F(" ovh us "));
+  uint32_t tenths = stats.txRing.frames ? stats.txRing.overheadSum * 5 / stats.txRing.frames : 0;
+  out.print(tenths / 10);
+  out.print('.');
+  out.print(tenths % 10);
+  out.print(F(" max "));
+  out.print(stats.txRing.overheadMax / 2);
+  out.print(stats.txRing.overheadMax & 1 ? F(".5") : F(".0"));
+}
+#endif
+
+#ifdef TX_LOOPBACK
+static void printLoopback(Print& out) {
+  // as measured on the wire; the bit time in tenths of a microsecond
+  out.print(F("wire ok "));
+  out.print(stats.loopback.frames);
+  out.print(F(" odd "));
+  out.print(stats.loopback.odd);
+  out.print(F(" mis "));
+  out.print(stats.loopback.mismatches);
+  out.print(F(" fe "));
+  out.print(stats.loopback.framingErrors);
+  out.print(F(" gl "));
+  out.print(stats.loopback.glitches);
+  out.print(F(" bit "));
+  uint32_t tenths = stats.loopback.bitCount ? stats.loopback.bitTicks * 5 / stats.loopback.bitCount : 0;
+  out.print(tenths / 10);
+  out.print('.');
+  out.print(tenths % 10);
+  out.print(F(" jit "));
+  out.print(stats.loopback.jitterMax);
+  out.print(F(" idle "));
+  out.print(stats.loopback.idleMin);
+  out.print('/');
+  out.print(stats.loopback.idleMax);
+  out.print(F(" cps "));
+  out.print(stats.loopback.periodMin ? 1000000UL / stats.loopback.periodMin : 0);
+}
+#endif
+
+typedef void (*StatsLineFn)(Print& out);
+
+static const StatsLineFn statsLines[] PROGMEM = {
+  printKeys,
+  printFrames,
+  printMemory,
+  printJobs,
+  printMbc,
+  printLatency,
+  printTasks,
+  printRepeat,
+#ifdef HOST_LINK
+  printHost,
+#endif
+#ifdef MATRIX
+  printMatrix,
+#endif
+#ifdef TRACE
+  printTrace,
+#endif
+#ifdef LINE_EDIT
+  printLineEdit,
+#endif
+#ifdef BOOT_SCRIPT
+  printBoot,
+#endif
+#ifdef REPLAY
+  printReplay,
+#endif
+#ifdef FLASH_STORE
+  printFlash,
+#endif
+#ifdef TX_RING
+  printTxRing,
+#endif
+#ifdef TX_LOOPBACK
+  printLoopback,
+#endif
+#ifdef PS2_CAPTURE
+  printPs2Capture,
+#endif
+};
+
+uint8_t statsLineCount() {
+  return sizeof(statsLines) / sizeof(statsLines[0]);
+}
+
+void printStatsLine(Print& out, uint8_t line) {
+  StatsLineFn fn = (StatsLineFn)pgm_read_ptr(&statsLines[line]);
+  fn(out);
+  out.print('\r');
+}
+
+void printStats(Print& out) {
+  for (uint8_t line = 0; line < statsLineCount(); line++) {
+    printStatsLine(out, line);
+  }
+}
+
+// line of the printout being typed
+static uint8_t statsLine;
+static TextBuffer statsText;
+static uint16_t statsTicket;
+
+void statsTask(Task* t) {
+  TASK_BEGIN(t);
+  for (statsLine = 0; statsLine < statsLineCount(); statsLine++) {
+    statsText.clear();
+    printStatsLine(statsText, statsLine);
+    TASK_WAIT_UNTIL(t, mbcSubmit(LANE_LOW, statsText.data, statsText.length, 0, &statsTicket));
+    // the job references statsText, wait before reusing it
+    TASK_WAIT_UNTIL(t, mbcJobDone(LANE_LOW, statsTicket));
+  }
+  TASK_END(t);
+}
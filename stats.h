@@ -0,0 +1,228 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file stats.h
+ * @brief Counters describing the adapter's input and output paths
+ *
+ * The counters are plain globals updated by the modules that own the
+ * respective buffers. They are meant to prove that bursts from fast
+ * PS/2 devices pass through the adapter without losing keys.
+ *
+ * With 2 KB of SRAM, buffers have to be sized from real data. Unused
+ * SRAM is painted at boot; the stack high-water mark is found by
+ * looking for the first byte that no longer carries the paint.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// counters of the input capture PS/2 receiver, see ps2capture.h
+struct Ps2CaptureStats {
+  uint32_t frames;         // scan codes received intact
+  uint16_t glitches;       // clock edges rejected as too close to the previous one
+  uint16_t resyncs;        // frames abandoned because an edge came too late
+  uint16_t framingErrors;  // bad start or stop bit
+  uint16_t parityErrors;   // parity errors
+  uint16_t overruns;       // scan codes lost because the main loop fell behind
+  uint16_t period;         // clock period of the last frame in 0.5us ticks
+};
+
+// frames seen on the MBC line through the loopback, see loopback.h
+struct LoopbackStats {
+  uint32_t frames;         // frames decoded
+  uint16_t odd;            // frames with odd parity
+  uint16_t mismatches;     // code or parity other than what was sent
+  uint16_t framingErrors;  // stop bit low
+  uint16_t glitches;       // pulses shorter than half a bit
+  uint16_t jitterMax;      // largest deviation of an edge in us
+  uint32_t bitTicks;       // sum of edge times in 0.5us ticks ...
+  uint32_t bitCount;       // ... and of their positions in bits
+  uint16_t gaps;           // frames measured against the one before
+  uint16_t idleMin;        // shortest time the line was high after the parity bit, us
+  uint16_t idleMax;        // longest, up to 65535us
+  uint16_t periodMin;      // start to start at idleMin, us
+};
+
+// counters of the interrupt driven transmitter, see txring.h
+struct TxRingStats {
+  uint32_t frames;       // frames loaded into the uart
+  uint32_t overheadSum;  // transport overhead in 0.5us ticks ...
+  uint16_t overheadMax;  // ... and the worst of it
+};
+
+// spacing of repeated keys in milliseconds
+struct IntervalStats {
+  uint16_t count;
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;
+};
+
+struct AdapterStats {
+  // input side
+  uint32_t keysIngested;    // codes moved from the PS2 library into the burst buffer
+  uint32_t keysDropped;     // codes lost because the burst buffer was full
+  uint32_t keysTranslated;  // codes handed to the translator
+  uint8_t ps2BacklogPeak;   // most codes found waiting in the PS2 library at once
+  uint8_t keyBufferPeak;    // highest burst buffer occupancy
+
+  // output side
+  uint32_t framesQueued;   // frames accepted by the output queue
+  uint32_t framesSent;     // frames written to the MBC line
+  uint32_t framesOdd;      // frames sent with odd parity (CTRL codes)
+  uint8_t frameQueuePeak;  // highest output queue occupancy
+  uint8_t jobQueuePeak;    // most jobs waiting on a single lane
+  uint32_t jobsSubmitted;  // jobs accepted on the injection lanes
+  uint32_t jobsRejected;   // submissions turned away because a lane was full
+  uint32_t framesInjected; // frames sent from injected jobs
+  uint32_t framesHeld;     // frames queued while the MBC was down or booting
+  uint32_t framesDiscarded;  // frames lost because the output queue was full
+  uint16_t mbcDownEvents;  // power losses or resets seen while the MBC was up
+
+
+  uint16_t taskDispatchCycles;  // cost of one pass through runTasks()
+
+  // key repeat regularity, as received and as sent to the MBC
+  IntervalStats repeatIn;
+  IntervalStats repeatOut;
+#ifdef REPEAT_ACCEL
+  uint16_t repeatSkipped;  // repeats dropped because the previous key was not out yet
+  uint8_t repeatPeakCps;   // fastest rate the acceleration reached
+#endif
+
+#ifdef HOST_LINK
+  uint32_t hostRxBytes;        // bytes received from the host
+  uint32_t hostParseMicros;    // time spent decoding them, without handling packets
+  uint16_t hostRxRate;         // highest bytes per second seen
+  uint16_t hostPacketsIn;      // valid packets received
+  uint16_t hostPacketsOut;     // packets sent
+  uint16_t hostCrcErrors;      // packets dropped for a wrong crc
+  uint16_t hostFramingErrors;  // packets dropped for bad cobs or length
+  uint32_t hostDataBytes;      // bytes of DATA packets passed to the output
+#endif
+
+#ifdef MATRIX
+  uint32_t matrixScans;     // complete scans of the key matrix
+  uint16_t matrixOverruns;  // key changes lost for a full event buffer
+#endif
+
+#ifdef TRACE
+  uint32_t traceRecords;  // keys and frames recorded
+  uint32_t traceBytes;    // bytes they took, including sync records
+#endif
+
+#ifdef LINE_EDIT
+  uint32_t lineKeys;    // keys handled by the line editor
+  uint32_t lineFrames;  // frames it sent, lines and CRs
+#endif
+
+#ifdef BOOT_SCRIPT
+  uint8_t bootSteps;     // steps of the last boot script sent so far
+  uint16_t bootLateMax;  // most milliseconds a step was queued after its time
+#endif
+
+#ifdef REPLAY
+  uint16_t replayKeys;             // keys played from the trace
+  uint16_t replayFrames;           // frames compared
+  uint16_t replayDivergences;      // frames other than, or missing from, the trace
+  uint16_t replayFirstDivergence;  // frame number of the first one, 0 for none
+  uint16_t replayExpected;         // its expected frame, 0x100 for odd parity, 0xFFFF for none
+  uint16_t replayActual;           // and the frame produced instead
+#endif
+
+#ifdef FLASH_STORE
+  uint16_t flashPageOps;          // pages erased or written
+  uint16_t flashCrcErrors;        // records skipped for a wrong crc
+  uint16_t flashCompactions;      // full store erased and rewritten
+  uint16_t settingsSaveFailures;  // settings that could not be appended
+#endif
+
+#ifdef TX_RING
+  TxRingStats txRing;
+#endif
+
+#ifdef TX_LOOPBACK
+  LoopbackStats loopback;
+#endif
+
+#ifdef PS2_CAPTURE
+  Ps2CaptureStats ps2Capture;
+  uint16_t ps2KeyboardOverruns;  // overrun codes sent by the keyboard
+#endif
+
+  // keystroke to wire latency, see LATENCY_BUCKETS
+  uint16_t latency[LATENCY_BUCKETS];
+  uint16_t latencyMax;  // worst latency seen in milliseconds
+};
+
+extern AdapterStats stats;
+
+/**
+ * @brief Add a sample to interval statistics
+ */
+void intervalRecord(IntervalStats& interval, uint16_t ms);
+
+/**
+ * @return Number of lines printed by printStatsLine()
+ */
+uint8_t statsLineCount();
+
+/**
+ * @brief Print one line of counters in a compact, human readable form
+ *
+ * Lines are short enough for a TextBuffer and end with '\r'.
+ *
+ * @param out Destination, e.g. Serial in debug mode or a TextBuffer
+ * @param line Line number, below statsLineCount()
+ */
+void printStatsLine(Print& out, uint8_t line);
+
+/**
+ * @brief Print all counters
+ *
+ * @param out Destination, e.g. Serial in debug mode
+ */
+void printStats(Print& out);
+
+/**
+ * @return Bytes currently free between the heap (or .bss) and the stack
+ */
+uint16_t memoryFree();
+
+/**
+ * @return Bytes between the heap (or .bss) and the deepest point the
+ *         stack has ever reached, i.e. the smallest free memory so far
+ */
+uint16_t memoryFreeLow();
+
+/**
+ * @brief Latency percentile from the histogram
+ *
+ * @param percent Percentile, e.g. 50, 90 or 99
+ * @return Upper bound of the bucket holding the percentile in
+ *         milliseconds, 0 if no latency has been recorded yet
+ */
+uint16_t latencyPercentile(uint8_t percent);
+
+#endif
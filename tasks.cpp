@@ -0,0 +1,98 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file tasks.cpp
+ * @brief Task table and dispatcher
+ */
+
+#include "tasks.h"
+#include "stats.h"
+
+#ifndef TINY
+static void benchTask(Task* t);
+#endif
+
+static const TaskFn taskTable[TASK_COUNT] PROGMEM = {
+  resetTask,
+  captureTask,
+#ifndef TINY
+  statsTask,
+  benchTask,
+#endif
+#ifdef FLASH_STORE
+  flashTask,
+#endif
+#ifdef BOOT_SCRIPT
+  bootTask,
+#endif
+};
+
+static Task tasks[TASK_COUNT];
+
+void taskStart(uint8_t id) {
+  tasks[id].line = TASK_START;
+}
+
+void taskStop(uint8_t id) {
+  tasks[id].line = TASK_STOPPED;
+}
+
+bool taskRunning(uint8_t id) {
+  return tasks[id].line != TASK_STOPPED;
+}
+
+void taskRun(uint8_t id) {
+  if (tasks[id].line != TASK_STOPPED) {
+    TaskFn fn = (TaskFn)pgm_read_ptr(&taskTable[id]);
+    fn(&tasks[id]);
+  }
+}
+
+void runTasks() {
+  for (uint8_t id = 0; id < TASK_COUNT; id++) {
+    taskRun(id);
+  }
+}
+
+#ifndef TINY
+static void benchTask(Task* t) {
+  TASK_BEGIN(t);
+  for (;;) {
+    TASK_YIELD(t);
+  }
+  TASK_END(t);
+}
+
+#define TASK_BENCH_ROUNDS 256
+
+void taskBenchmark() {
+  taskStart(TASK_BENCH);
+  unsigned long start = micros();
+  for (uint16_t i = 0; i < TASK_BENCH_ROUNDS; i++) {
+    runTasks();
+  }
+  unsigned long elapsed = micros() - start;
+  taskStop(TASK_BENCH);
+
+  // one full pass dispatches the benchmark task and skips the others
+  stats.taskDispatchCycles = elapsed * clockCyclesPerMicrosecond() / TASK_BENCH_ROUNDS;
+}
+#endif
@@ -0,0 +1,164 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file tasks.h
+ * @brief Stackless coroutines for long running adapter activities
+ *
+ * Activities such as the reset pulse, capture mode or the boot script are
+ * written as sequential code that yields while it waits, in the style
+ * of protothreads: a task function resumes at the line it left off by
+ * switching on the line number stored in its Task. A task therefore
+ * costs four bytes of RAM and no stack of its own.
+ *
+ * Local variables do not survive a yield; keep state in statics. Do
+ * not use switch statements around a yield inside a task.
+ *
+ *   void blinkTask(Task* t) {
+ *     TASK_BEGIN(t);
+ *     for (;;) {
+ *       digitalWrite(LED_BUILTIN, HIGH);
+ *       TASK_DELAY(t, 100);
+ *       digitalWrite(LED_BUILTIN, LOW);
+ *       TASK_WAIT_UNTIL(t, buttonPressed());
+ *     }
+ *     TASK_END(t);
+ *   }
+ */
+
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <Arduino.h>
+#include "config.h"
+
+struct Task {
+  uint16_t line;   // where to resume, TASK_STOPPED or TASK_START
+  uint16_t timer;  // start of the current TASK_DELAY in milliseconds
+};
+
+typedef void (*TaskFn)(Task* t);
+
+#define TASK_STOPPED 0
+#define TASK_START 1
+
+#define TASK_BEGIN(t) \
+  switch ((t)->line) { \
+    case TASK_START:
+
+#define TASK_YIELD(t) \
+  do { \
+    (t)->line = __LINE__; \
+    return; \
+    case __LINE__:; \
+  } while (0)
+
+#define TASK_WAIT_UNTIL(t, condition) \
+  do { \
+    (t)->line = __LINE__; \
+    case __LINE__: \
+      if (!(condition)) { \
+        return; \
+      } \
+  } while (0)
+
+// delays up to 65 seconds
+#define TASK_DELAY(t, ms) \
+  do { \
+    (t)->timer = millis(); \
+    TASK_WAIT_UNTIL(t, (uint16_t)((uint16_t)millis() - (t)->timer) >= (uint16_t)(ms)); \
+  } while (0)
+
+#define TASK_EXIT(t) \
+  do { \
+    (t)->line = TASK_STOPPED; \
+    return; \
+  } while (0)
+
+#define TASK_END(t) \
+  } \
+  (t)->line = TASK_STOPPED
+
+// ---------------------------------------------------
+// Tasks of the adapter, see taskTable in tasks.cpp
+// ---------------------------------------------------
+#define TASK_RESET 0     // reset pulse to the MBC
+#define TASK_CAPTURE 1   // CTRL-ALT-A hex capture
+#ifdef TINY
+// only what is in the table is linked
+#define TASK_COUNT 2
+#else
+#define TASK_STATS 2     // types the counters into the MBC
+#define TASK_BENCH 3     // empty task, measures the dispatch overhead
+#ifdef FLASH_STORE
+#define TASK_FLASH 4     // programs flash pages between keystrokes
+#define TASK_OPTIONAL 5  // id of the next optional task
+#else
+#define TASK_OPTIONAL 4
+#endif
+#ifdef BOOT_SCRIPT
+#define TASK_BOOT TASK_OPTIONAL  // plays the boot script after a reset
+#define TASK_COUNT (TASK_OPTIONAL + 1)
+#else
+#define TASK_COUNT TASK_OPTIONAL
+#endif
+#endif
+
+void resetTask(Task* t);
+void captureTask(Task* t);
+void statsTask(Task* t);
+void flashTask(Task* t);
+void bootTask(Task* t);
+
+/**
+ * @brief Start a task from the top, also if it is running already
+ */
+void taskStart(uint8_t id);
+
+/**
+ * @brief Stop a task; it will not be dispatched until started again
+ */
+void taskStop(uint8_t id);
+
+/**
+ * @return true while the task has not finished
+ */
+bool taskRunning(uint8_t id);
+
+/**
+ * @brief Dispatch a single task right away, if it is running
+ */
+void taskRun(uint8_t id);
+
+/**
+ * @brief Dispatch every running task once. Call from loop().
+ */
+void runTasks();
+
+/**
+ * @brief Measure the cost of a dispatch through runTasks()
+ *
+ * Runs the empty benchmark task a few hundred times and stores the
+ * average cycles per dispatch in the stats. Call from setup(), before
+ * any other task has been started.
+ */
+void taskBenchmark();
+
+#endif
@@ -0,0 +1,190 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file matrix_test.cpp
+ * @brief Host test of the key matrix debounce against a simulated matrix
+ *
+ * A simulated matrix of 9 rows and 8 columns, a diode per switch, is
+ * scanned row by row through debounceRow() as matrixScan() does. Its
+ * switches bounce for up to BOUNCE_SCANS scans after each change.
+ * Checked are:
+ * - one event per press and release, none from bounces or short glitches
+ * - the event at the latest 4 scans after the contact settles
+ * - any number of keys held at once (n-key rollover)
+ *
+ * Build and run from this directory:
+ *
+ *   g++ -std=c++11 -Wall -I.. -o matrix_test matrix_test.cpp && ./matrix_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debounce.h"
+
+#define ROWS 9
+#define COLS 8
+#define BOUNCE_SCANS 3  // scans a contact reads at random after a change
+#define SETTLE_SCANS 4  // equal samples before the state flips
+
+static DebounceRow rows[ROWS];
+// switch positions and the scans each one still bounces
+static bool closed[ROWS][COLS];
+static int bouncing[ROWS][COLS];
+// events seen and the scan of the last one, per switch
+static int makes[ROWS][COLS];
+static int breaks[ROWS][COLS];
+static int eventScan[ROWS][COLS];
+static int scan;
+static int failures;
+
+#define CHECK(cond, ...)    \
+  do {                      \
+    if (!(cond)) {          \
+      printf(__VA_ARGS__);  \
+      printf("\n");         \
+      failures++;           \
+    }                       \
+  } while (0)
+
+static void reset() {
+  memset(rows, 0, sizeof(rows));
+  memset(closed, 0, sizeof(closed));
+  memset(bouncing, 0, sizeof(bouncing));
+  memset(makes, 0, sizeof(makes));
+  memset(breaks, 0, sizeof(breaks));
+  scan = 0;
+}
+
+static void setSwitch(int r, int c, bool on, int bounce) {
+  closed[r][c] = on;
+  bouncing[r][c] = bounce;
+}
+
+/**
+ * One scan of the whole matrix. With a diode per switch, a row reads
+ * exactly its own closed switches.
+ */
+static void scanMatrix() {
+  for (int r = 0; r < ROWS; r++) {
+    uint8_t sample = 0;
+    for (int c = 0; c < COLS; c++) {
+      bool contact = closed[r][c];
+      if (bouncing[r][c] > 0) {
+        contact = rand() & 1;
+        bouncing[r][c]--;
+      }
+      sample |= contact << c;
+    }
+    uint8_t toggle = debounceRow(rows[r], sample);
+    for (int c = 0; c < COLS; c++) {
+      if (toggle & (1 << c)) {
+        if (rows[r].state & (1 << c)) {
+          makes[r][c]++;
+        } else {
+          breaks[r][c]++;
+        }
+        eventScan[r][c] = scan;
+      }
+    }
+  }
+  scan++;
+}
+
+static void scanFor(int count) {
+  for (int i = 0; i < count; i++) {
+    scanMatrix();
+  }
+}
+
+static void testBouncingPresses() {
+  for (int round = 0; round < 20000; round++) {
+    reset();
+    int r = rand() % ROWS;
+    int c = rand() % COLS;
+    int presses = 1 + rand() % 5;
+    for (int i = 0; i < presses; i++) {
+      int bounce = rand() % (BOUNCE_SCANS + 1);
+      setSwitch(r, c, true, bounce);
+      int changed = scan;
+      scanFor(bounce + SETTLE_SCANS + rand() % 20);
+      CHECK(eventScan[r][c] >= changed && eventScan[r][c] <= changed + bounce + SETTLE_SCANS - 1,
+            "press at scan %d, changed at %d, bounced %d", eventScan[r][c], changed, bounce);
+
+      bounce = rand() % (BOUNCE_SCANS + 1);
+      setSwitch(r, c, false, bounce);
+      changed = scan;
+      scanFor(bounce + SETTLE_SCANS + rand() % 20);
+      CHECK(eventScan[r][c] >= changed && eventScan[r][c] <= changed + bounce + SETTLE_SCANS - 1,
+            "release at scan %d, changed at %d, bounced %d", eventScan[r][c], changed, bounce);
+    }
+    CHECK(makes[r][c] == presses && breaks[r][c] == presses, "%d presses gave %d makes, %d breaks", presses,
+          makes[r][c], breaks[r][c]);
+  }
+}
+
+static void testGlitches() {
+  reset();
+  // closed for fewer samples than it takes to settle, with gaps between
+  for (int length = 1; length < SETTLE_SCANS; length++) {
+    for (int i = 0; i < 50; i++) {
+      setSwitch(3, 5, true, 0);
+      scanFor(length);
+      setSwitch(3, 5, false, 0);
+      scanFor(1 + rand() % 3);
+    }
+  }
+  CHECK(makes[3][5] == 0 && breaks[3][5] == 0, "glitches gave %d makes, %d breaks", makes[3][5], breaks[3][5]);
+}
+
+static void testRollover() {
+  reset();
+  for (int r = 0; r < ROWS; r++) {
+    for (int c = 0; c < COLS; c++) {
+      setSwitch(r, c, true, rand() % (BOUNCE_SCANS + 1));
+    }
+  }
+  scanFor(BOUNCE_SCANS + SETTLE_SCANS);
+  // release every other switch while the rest stay held
+  for (int r = 0; r < ROWS; r++) {
+    for (int c = (r & 1); c < COLS; c += 2) {
+      setSwitch(r, c, false, rand() % (BOUNCE_SCANS + 1));
+    }
+  }
+  scanFor(BOUNCE_SCANS + SETTLE_SCANS);
+  for (int r = 0; r < ROWS; r++) {
+    for (int c = 0; c < COLS; c++) {
+      bool released = (c & 1) == (r & 1);
+      CHECK(makes[r][c] == 1 && breaks[r][c] == (released ? 1 : 0), "key %d/%d: %d makes, %d breaks", r, c,
+            makes[r][c], breaks[r][c]);
+      CHECK(((rows[r].state >> c) & 1) == closed[r][c], "key %d/%d state differs from the switch", r, c);
+    }
+  }
+}
+
+int main() {
+  srand(1);
+  testBouncingPresses();
+  testGlitches();
+  testRollover();
+  printf("matrix_test: %d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,102 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file seqlock_test.cpp
+ * @brief Host stress test of the sequence lock against torn copies
+ *
+ * The main loop's copy of a multi-byte block is modelled byte by byte,
+ * and a simulated interrupt fires at random byte boundaries of it, as
+ * one can on the AVR. The interrupt keeps all fields of the block equal,
+ * so a copy with unequal fields is torn. Every copy accepted by
+ * seqlockReadRetry() must be whole; a run without the retry must see
+ * torn copies, or the test could not notice them.
+ *
+ * Build and run from this directory:
+ *
+ *   g++ -std=c++11 -Wall -I.. -o seqlock_test seqlock_test.cpp && ./seqlock_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "seqlock.h"
+
+#define COPIES 2000000L
+
+struct Block {
+  uint32_t a;
+  uint16_t b;
+  uint32_t c;
+};
+
+static volatile Block shared;
+static Seqlock sharedSeq;
+
+static void interrupt() {
+  uint32_t value = shared.a + 1;
+  shared.a = value;
+  shared.b = (uint16_t)value;
+  shared.c = value;
+  seqlockWrite(sharedSeq);
+}
+
+// copies the block, interrupted before about every eighth byte
+static void copyBlock(Block* copy) {
+  uint8_t* to = (uint8_t*)copy;
+  const volatile uint8_t* from = (const volatile uint8_t*)&shared;
+  for (unsigned i = 0; i < sizeof(Block); i++) {
+    if (rand() % 8 == 0) {
+      interrupt();
+    }
+    to[i] = from[i];
+  }
+}
+
+static bool torn(const Block& copy) {
+  return copy.a != copy.c || (uint16_t)copy.a != copy.b;
+}
+
+int main() {
+  srand(1);
+  long tornCopies = 0;
+  long retries = 0;
+  for (long i = 0; i < COPIES; i++) {
+    Block copy;
+    uint8_t seq;
+    do {
+      seq = seqlockReadBegin(sharedSeq);
+      copyBlock(&copy);
+      retries++;
+    } while (seqlockReadRetry(sharedSeq, seq));
+    retries--;
+    tornCopies += torn(copy);
+  }
+
+  long tornUnlocked = 0;
+  for (long i = 0; i < COPIES; i++) {
+    Block copy;
+    copyBlock(&copy);
+    tornUnlocked += torn(copy);
+  }
+
+  printf("seqlock_test: %ld of %ld copies torn, %ld retries; %ld torn without the lock\n", tornCopies, COPIES,
+         retries, tornUnlocked);
+  return tornCopies != 0 || tornUnlocked == 0;
+}
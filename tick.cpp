@@ -0,0 +1,65 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file tick.cpp
+ * @brief Timer2 compare match interrupt dispatching to the backends
+ */
+
+#include "tick.h"
+#include <util/atomic.h>
+#include "matrix.h"
+#include "softuart.h"
+#include "txring.h"
+#include "replay.h"
+#include "autorepeat.h"
+
+void tickBegin() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS21);
+    OCR2A = TICK_COMPARE;
+    TCNT2 = 0;
+    TIFR2 = _BV(OCF2A);
+    TIMSK2 = _BV(OCIE2A);
+  }
+}
+
+#if defined(MATRIX) || SOFT_UARTS > 0 || defined(TX_RING) || defined(REPLAY) || \
+    defined(REPEAT_ACCEL)
+ISR(TIMER2_COMPA_vect) {
+#ifdef TX_RING
+  txRingTick();
+#endif
+#if SOFT_UARTS > 0
+  // bit timing first, it must not jitter with the scan's run time
+  softUartTick();
+#endif
+#ifdef MATRIX
+  matrixScan();
+#endif
+#ifdef REPLAY
+  replayTick();
+#endif
+#ifdef REPEAT_ACCEL
+  repeatTick();
+#endif
+}
+#endif
@@ -0,0 +1,47 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file tick.h
+ * @brief Timer2 interrupt shared by the software timed backends
+ *
+ * Timer2 runs in CTC mode at TICK_HZ, 8 times the 1200 baud of the MBC
+ * line, which suits bit timing as well as scanning a key matrix row by
+ * row. Backends that need it are called from the one interrupt, so they
+ * share a single timer and a single set of register saves.
+ */
+
+#ifndef TICK_H
+#define TICK_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// clk/8 and a compare value of 207: 16MHz / 8 / 208
+#define TICK_PRESCALE 8
+#define TICK_COMPARE 207
+#define TICK_HZ (F_CPU / TICK_PRESCALE / (TICK_COMPARE + 1))
+
+/**
+ * @brief Start the tick interrupt; calling it again does no harm
+ */
+void tickBegin();
+
+#endif
@@ -0,0 +1,158 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file trace.cpp
+ * @brief Delta and varint encoded trace in a RAM ring
+ */
+
+#include "trace.h"
+
+#ifdef TRACE
+
+#include "output.h"
+#include "stats.h"
+
+#define TRACE_SYNC_POINTS 16  // index entries (power of two)
+#define TRACE_RECORD_MAX 9    // sync record plus the longest other record
+
+#if TRACE_BUFFER_SIZE / TRACE_SYNC_INTERVAL >= TRACE_SYNC_POINTS
+#error "TRACE_SYNC_INTERVAL too small for the sync point index"
+#endif
+// making room must never drop the only sync point
+#if TRACE_SYNC_INTERVAL + 2 * TRACE_RECORD_MAX > TRACE_BUFFER_SIZE
+#error "TRACE_SYNC_INTERVAL too large for TRACE_BUFFER_SIZE"
+#endif
+
+struct SyncPoint {
+  uint16_t position;  // of the sync record in the ring
+  uint32_t time;      // millis() it carries
+};
+
+// head and tail run freely, tail is always at a sync point
+static uint8_t traceBuffer[TRACE_BUFFER_SIZE];
+static uint16_t traceHead = 0;
+static uint16_t traceTail = 0;
+
+static SyncPoint syncPoints[TRACE_SYNC_POINTS];
+static uint8_t syncHead = 0;
+static uint8_t syncTail = 0;
+
+// time of the previous record and bytes since the last sync point
+static uint32_t lastTime;
+static uint16_t sinceSync = TRACE_SYNC_INTERVAL;
+
+static void dropOldest() {
+  syncTail++;
+  traceTail = syncPoints[syncTail & (TRACE_SYNC_POINTS - 1)].position;
+}
+
+static void putByte(uint8_t b) {
+  traceBuffer[traceHead & (TRACE_BUFFER_SIZE - 1)] = b;
+  traceHead++;
+  sinceSync++;
+  stats.traceBytes++;
+}
+
+static void putVarint(uint32_t value) {
+  while (value >= 0x80) {
+    putByte(value | 0x80);
+    value >>= 7;
+  }
+  putByte(value);
+}
+
+/**
+ * @brief Start a record: make room, sync if due, write the header
+ */
+static void beginRecord(uint8_t type) {
+  uint32_t now = millis();
+  while ((uint16_t)(traceHead - traceTail) > TRACE_BUFFER_SIZE - TRACE_RECORD_MAX) {
+    dropOldest();
+  }
+
+  if (sinceSync >= TRACE_SYNC_INTERVAL) {
+    if ((uint8_t)(syncHead - syncTail) >= TRACE_SYNC_POINTS) {
+      dropOldest();
+    }
+    SyncPoint& sync = syncPoints[syncHead & (TRACE_SYNC_POINTS - 1)];
+    sync.position = traceHead;
+    sync.time = now;
+    syncHead++;
+    if (syncHead - syncTail == 1) {
+      traceTail = traceHead;
+    }
+    putByte(TRACE_SYNC);
+    putVarint(now);
+    sinceSync = 0;
+    lastTime = now;
+  }
+
+  uint32_t delta = now - lastTime;
+  lastTime = now;
+  if (delta < TRACE_DELTA_VARINT) {
+    putByte(type | (delta << 2));
+  } else {
+    putByte(type | (TRACE_DELTA_VARINT << 2));
+    putVarint(delta);
+  }
+  stats.traceRecords++;
+}
+
+void traceKey(uint16_t code) {
+  beginRecord(TRACE_KEY);
+  putByte(code & 0xFF);
+  putVarint(code >> 8);
+}
+
+void traceFrame(uint8_t code, uint8_t flags) {
+  beginRecord(flags & FRAME_ODD_PARITY ? TRACE_FRAME_ODD : TRACE_FRAME);
+  putByte(code);
+}
+
+uint16_t traceSeek(uint32_t time) {
+  // last sync point with a time at or before the one asked for
+  uint8_t low = 0;
+  uint8_t high = syncHead - syncTail;
+  while (high - low > 1) {
+    uint8_t middle = (low + high) / 2;
+    if (syncPoints[(uint8_t)(syncTail + middle) & (TRACE_SYNC_POINTS - 1)].time <= time) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return syncHead == syncTail ? traceTail
+                              : syncPoints[(uint8_t)(syncTail + low) & (TRACE_SYNC_POINTS - 1)].position;
+}
+
+uint8_t traceRead(uint16_t* position, uint8_t* data, uint8_t length) {
+  if ((uint16_t)(*position - traceTail) > (uint16_t)(traceHead - traceTail)) {
+    *position = traceTail;
+  }
+  uint8_t count = 0;
+  while (count < length && *position != traceHead) {
+    data[count++] = traceBuffer[*position & (TRACE_BUFFER_SIZE - 1)];
+    (*position)++;
+  }
+  return count;
+}
+
+#endif
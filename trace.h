@@ -0,0 +1,101 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file trace.h
+ * @brief Compact recording of keys and frames with seekable sync points
+ *
+ * With TRACE enabled, every key taken from the keyboard and every frame
+ * sent to the MBC is recorded into a RAM ring of TRACE_BUFFER_SIZE
+ * bytes. Records are delta encoded and take two to four bytes:
+ *
+ *   header: bits 0-1 record type, bits 2-7 milliseconds since the
+ *           previous record; 63 means a varint with the delta follows
+ *   TRACE_SYNC       varint absolute millis(), header delta is 0
+ *   TRACE_KEY        key byte, varint status bits (code >> 8)
+ *   TRACE_FRAME      code byte, sent with even parity
+ *   TRACE_FRAME_ODD  code byte, sent with a parity error
+ *
+ * Varints are little endian base 128, bit 7 set on all but the last
+ * byte. A sync record starts the trace and follows every
+ * TRACE_SYNC_INTERVAL bytes, so decoding can begin at any sync point.
+ * When the ring is full, the oldest interval up to the next sync point
+ * is dropped. The sync points are indexed, so finding the one before a
+ * given time is a binary search.
+ *
+ * The host link dumps the trace with HOST_MSG_TRACE; a dump can be
+ * played back with REPLAY, see replay.h.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// record types, also read by the replay
+#define TRACE_SYNC 0
+#define TRACE_KEY 1
+#define TRACE_FRAME 2
+#define TRACE_FRAME_ODD 3
+#define TRACE_DELTA_VARINT 63  // header delta: a varint follows
+
+#ifdef TRACE
+
+#if TRACE_BUFFER_SIZE > 32768 || (TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1))
+#error "TRACE_BUFFER_SIZE has to be a power of two"
+#endif
+
+/**
+ * @brief Record a key code taken from the keyboard
+ */
+void traceKey(uint16_t code);
+
+/**
+ * @brief Record a frame handed to the wire
+ *
+ * @param flags FRAME_* flags of the frame
+ */
+void traceFrame(uint8_t code, uint8_t flags);
+
+/**
+ * @brief Find where to start reading for a point in time
+ *
+ * @param time millis() of the earliest record of interest
+ * @return Position of the last sync point at or before time, or of the
+ *         oldest one; pass to traceRead()
+ */
+uint16_t traceSeek(uint32_t time);
+
+/**
+ * @brief Copy recorded bytes
+ *
+ * @param position Where to read, advanced by the bytes copied. If the
+ *                 bytes have been overwritten meanwhile, reading resumes
+ *                 at the oldest sync point.
+ * @param data Receives the bytes
+ * @param length Size of data
+ * @return Number of bytes copied, 0 at the end of the trace
+ */
+uint8_t traceRead(uint16_t* position, uint8_t* data, uint8_t length);
+
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file translate.cpp
+ * @brief Range and table driven key translation
+ */
+
+#include "translate.h"
+#include <PS2KeyAdvanced.h>
+#include "scancodes.h"
+
+// keys outside the ranges; 0 means the key sends nothing
+struct KeyTranslation {
+  uint8_t key;      // PS2_KEY_* code
+  uint8_t lower;    // without shift and caps lock
+  uint8_t upper;    // with shift or caps lock
+  uint8_t control;  // with CTRL, sent with even parity
+};
+
+static const KeyTranslation keyTranslations[] PROGMEM = {
+  {PS2_KEY_ENTER, MBC_RETURN, MBC_RETURN, CTRL_ENTER},
+  {PS2_KEY_KP_ENTER, MBC_ENTER, MBC_ENTER, CTRL_ENTER},
+  {PS2_KEY_DELETE, MBC_BACKSPACE, MBC_BACKSPACE, 0},
+  {PS2_KEY_BS, MBC_BACKSPACE, MBC_BACKSPACE, 0},
+  {PS2_KEY_INSERT, MBC_INSERT, MBC_INSERT, 0},
+  {PS2_KEY_TAB, MBC_TAB, MBC_BACKTAB, CTRL_TAB},
+  {PS2_KEY_BREAK, CTRL_C, CTRL_C, 0},  // todo: not sure what break sends
+  {PS2_KEY_ESC, MBC_ESC, MBC_ESC, 0},
+  // keypad
+  {PS2_KEY_KP_EQUAL, '=', '=', 0},
+  {PS2_KEY_KP_MINUS, '-', '-', 0},
+  {PS2_KEY_KP_PLUS, '+', '+', 0},
+  {PS2_KEY_KP_DIV, '/', '/', 0},
+  {PS2_KEY_KP_TIMES, '*', '*', 0},
+  {PS2_KEY_KP_DOT, '.', '.', 0},
+  // cursor block, also the keypad without num lock
+  {PS2_KEY_END, MBC_END, MBC_END, CTRL_END},
+  {PS2_KEY_PGUP, MBC_PG_UP, MBC_PG_UP, 0},
+  {PS2_KEY_PGDN, MBC_PG_DOWN, MBC_PG_DOWN, CTRL_PGDN},
+  {PS2_KEY_L_ARROW, MBC_CRS_LEFT, MBC_CRS_LEFT, 0},
+  {PS2_KEY_R_ARROW, MBC_CRS_RIGHT, MBC_CRS_RIGHT, 0},
+  {PS2_KEY_DN_ARROW, MBC_CRS_DOWN, MBC_CRS_DOWN, 0},
+  {PS2_KEY_UP_ARROW, MBC_CRS_UP, MBC_CRS_UP, 0},
+  {PS2_KEY_HOME, MBC_HOME, MBC_HOME, CTRL_HOME},
+  // punctuation
+  {PS2_KEY_DOT, '.', '>', 0},
+  {PS2_KEY_DIV, '/', '?', 0},
+  {PS2_KEY_EQUAL, '=', '+', 0},
+  {PS2_KEY_MINUS, '-', '_', 0},
+  {PS2_KEY_COMMA, ',', '<', 0},
+  {PS2_KEY_APOS, '\'', '\"', 0},
+  {PS2_KEY_SEMI, ';', ':', 0},
+  {PS2_KEY_OPEN_SQ, '[', '{', CTRL_OPEN_SQ},
+  {PS2_KEY_CLOSE_SQ, ']', '}', CTRL_CLOSE_SQ},
+  {PS2_KEY_SPACE, ' ', ' ', 0},
+  {PS2_KEY_BACK, '\\', '|', 0},
+};
+
+// shifted digits, from 0 to 9
+static const char shiftedDigits[] PROGMEM = ")!@#$%^&*(";
+
+// graph mode, only A is known so far (see GRAPH_* in scancodes.h)
+struct GraphTranslation {
+  uint8_t key;
+  uint8_t graph;
+};
+
+static const GraphTranslation graphTranslations[] PROGMEM = {
+  {PS2_KEY_A, GRAPH_A},
+};
+
+static bool graphKey(uint8_t key, SeqFrame* frame) {
+  for (uint8_t i = 0; i < sizeof(graphTranslations) / sizeof(graphTranslations[0]); i++) {
+    if (pgm_read_byte(&graphTranslations[i].key) == key) {
+      frame->code = pgm_read_byte(&graphTranslations[i].graph);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Letters send themselves with a parity error, CTRL-C is the one that
+ * is sent as the ascii control code.
+ */
+static bool controlKey(uint8_t key, bool upper, SeqFrame* frame) {
+  if (key >= PS2_KEY_A && key <= PS2_KEY_Z) {
+    if (key == PS2_KEY_C) {
+      frame->code = CTRL_C;
+    } else {
+      frame->code = (upper ? 'A' : 'a') + key - PS2_KEY_A;
+      frame->flags = FRAME_ODD_PARITY;
+    }
+    return true;
+  }
+  if (key >= PS2_KEY_F1 && key <= PS2_KEY_F10) {
+    frame->code = CTRL_F1 + key - PS2_KEY_F1;
+    return true;
+  }
+  for (uint8_t i = 0; i < sizeof(keyTranslations) / sizeof(keyTranslations[0]); i++) {
+    if (pgm_read_byte(&keyTranslations[i].key) == key) {
+      frame->code = pgm_read_byte(&keyTranslations[i].control);
+      return frame->code != 0;
+    }
+  }
+  return false;
+}
+
+static bool regularKey(uint8_t key, bool upper, SeqFrame* frame) {
+  if (key >= PS2_KEY_A && key <= PS2_KEY_Z) {
+    frame->code = (upper ? 'A' : 'a') + key - PS2_KEY_A;
+    return true;
+  }
+  if (key >= PS2_KEY_0 && key <= PS2_KEY_9) {
+    frame->code = upper ? pgm_read_byte(&shiftedDigits[key - PS2_KEY_0]) : '0' + key - PS2_KEY_0;
+    return true;
+  }
+  if (key >= PS2_KEY_KP0 && key <= PS2_KEY_KP9) {
+    frame->code = '0' + key - PS2_KEY_KP0;
+    return true;
+  }
+  if (key >= PS2_KEY_F1 && key <= PS2_KEY_F10) {
+    frame->code = MBC_F1 + key - PS2_KEY_F1;
+    return true;
+  }
+  for (uint8_t i = 0; i < sizeof(keyTranslations) / sizeof(keyTranslations[0]); i++) {
+    if (pgm_read_byte(&keyTranslations[i].key) == key) {
+      frame->code = pgm_read_byte(upper ? &keyTranslations[i].upper : &keyTranslations[i].lower);
+      return frame->code != 0;
+    }
+  }
+  return false;
+}
+
+bool translateKey(uint16_t code, SeqFrame* frame) {
+  uint8_t key = code & 0xFF;
+  bool upper = code & (PS2_SHIFT | PS2_CAPS);
+  frame->flags = 0;
+
+  if (code & PS2_ALT_GR) {
+    return graphKey(key, frame);
+  }
+  if (code & PS2_CTRL) {
+    return controlKey(key, upper, frame);
+  }
+  return regularKey(key, upper, frame);
+}
@@ -0,0 +1,53 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file translate.h
+ * @brief Table driven translation of PC keys into MBC codes
+ *
+ * Letters, digits, keypad digits and function keys are translated by
+ * their offset in the contiguous PS2_KEY_* ranges; the remaining keys
+ * are looked up in a small table in flash. Hotkeys, capture mode and
+ * key mapping profiles are handled by the sketch before.
+ *
+ * The original switch statements are kept as the reference for the
+ * differential self-test, see selftest.h.
+ */
+
+#ifndef TRANSLATE_H
+#define TRANSLATE_H
+
+#include <Arduino.h>
+#include "output.h"
+
+/**
+ * @brief Translate a key into the frame for the MBC
+ *
+ * AltGr selects graph mode and takes precedence over CTRL, which sends
+ * control codes, most of them with a parity error. Shift and Caps Lock
+ * both select the upper case, also for digits and punctuation.
+ *
+ * @param code PS2KeyAdvanced code including status bits
+ * @param frame Receives the code and FRAME_ODD_PARITY if needed
+ * @return false if the key sends nothing
+ */
+bool translateKey(uint16_t code, SeqFrame* frame);
+
+#endif
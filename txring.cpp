@@ -0,0 +1,170 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file txring.cpp
+ * @brief Frame ring between serviceOutput() and the Timer2 tick
+ */
+
+#include "txring.h"
+
+#ifdef TX_RING
+
+#include <util/atomic.h>
+#include "output.h"
+#include "seqlock.h"
+#include "stats.h"
+#include "tick.h"
+
+// ticks from loading a frame until the next one may follow: its own
+// transmit time plus the gap, rounded up
+#define TX_RING_WAIT_TICKS \
+  (((MBC_FRAME_US + MBC_FRAME_GAP_US) * TICK_HZ + 999999UL) / 1000000UL)
+
+struct RingFrame {
+  uint8_t code;
+  uint8_t flags;
+};
+
+static volatile RingFrame ring[TX_RING_SIZE];
+static volatile uint8_t ringHead;  // written by the main loop only
+static volatile uint8_t ringTail;  // written with interrupts off only
+
+// transmitter state, only touched with interrupts off
+static uint16_t ticks;
+static uint16_t wait;
+static bool lineFree = true;
+static uint8_t parity;   // FRAME_ODD_PARITY the uart is set up for
+
+// counters, written by the isr
+static volatile TxRingStats isrStats;
+static Seqlock isrStatsSeq;
+
+/**
+ * @return Time in half microseconds, from the tick count and Timer2.
+ *         Interrupts have to be off.
+ */
+static uint16_t stamp() {
+  uint8_t count = TCNT2;
+  uint16_t elapsed = ticks;
+  // a compare match may be pending
+  if ((TIFR2 & _BV(OCF2A)) && count < (TICK_COMPARE + 1) / 2) {
+    elapsed++;
+  }
+  return elapsed * (TICK_COMPARE + 1) + count;
+}
+
+/**
+ * @brief Move the frame at the tail into the uart. Interrupts have to be off.
+ *
+ * @param ready stamp() when both the frame and the line were ready
+ */
+static void load(uint16_t ready) {
+  volatile RingFrame& frame = ring[ringTail & (TX_RING_SIZE - 1)];
+  uint8_t odd = frame.flags & FRAME_ODD_PARITY;
+  if (odd != parity) {
+    // the line is idle, the parity can be switched in place
+    MBC_UCSRC = odd ? MBC_SR_CFG_CTRL : MBC_SR_CFG;
+    parity = odd;
+  }
+  // clear TXC by writing a one, keep the baud rate doubler
+  MBC_UCSRA = (MBC_UCSRA & (_BV(MBC_U2X) | _BV(MBC_MPCM))) | _BV(MBC_TXC);
+  MBC_UDR = frame.code;
+
+  uint16_t overhead = stamp() - ready;
+  isrStats.frames++;
+  isrStats.overheadSum += overhead;
+  if (overhead > isrStats.overheadMax) {
+    isrStats.overheadMax = overhead;
+  }
+  seqlockWrite(isrStatsSeq);
+
+  ringTail++;
+  lineFree = false;
+  wait = TX_RING_WAIT_TICKS;
+}
+
+void txRingTick() {
+  ticks++;
+  if (wait && --wait) {
+    return;
+  }
+  if (!lineFree) {
+    // the estimate may be a bit short, the uart has the last word
+    if (!bit_is_set(MBC_UCSRA, MBC_TXC)) {
+      return;
+    }
+    lineFree = true;
+  }
+  // waiting frames were ready before the line, which has been ready
+  // since the compare match, so the interrupt latency counts too
+  if (ringTail != ringHead) {
+    load(ticks * (TICK_COMPARE + 1));
+  }
+}
+
+void txRingBegin() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    parity = 0;
+    lineFree = true;
+  }
+  tickBegin();
+}
+
+uint8_t txRingFree() {
+  return TX_RING_SIZE - (uint8_t)(ringHead - ringTail);
+}
+
+bool txRingIdle() {
+  bool idle;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    idle = lineFree && ringTail == ringHead;
+  }
+  return idle;
+}
+
+bool txRingPush(uint8_t code, uint8_t flags) {
+  uint8_t head = ringHead;
+  if ((uint8_t)(head - ringTail) >= TX_RING_SIZE) {
+    return false;
+  }
+  volatile RingFrame& frame = ring[head & (TX_RING_SIZE - 1)];
+  frame.code = code;
+  frame.flags = flags;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint16_t pushedAt = stamp();
+    ringHead = head + 1;
+    // a free line takes the frame now rather than at the next tick
+    if (lineFree && ringTail == head) {
+      load(pushedAt);
+    }
+  }
+  return true;
+}
+
+void txRingStats() {
+  uint8_t seq;
+  do {
+    seq = seqlockReadBegin(isrStatsSeq);
+    stats.txRing = *(TxRingStats*)&isrStats;
+  } while (seqlockReadRetry(isrStatsSeq, seq));
+}
+
+#endif
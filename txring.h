@@ -0,0 +1,88 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file txring.h
+ * @brief Interrupt driven transmitter fed through a lock-free frame ring
+ *
+ * Without it, frames are written to the uart from the main loop, so each
+ * one waits for the loop to come around: any slow pass (a flash write,
+ * a stats line being formatted) shows up as keystroke latency. With
+ * TX_RING, serviceOutput() hands frames with their parity to a small
+ * single-producer, single-consumer ring and the Timer2 tick takes them
+ * to the wire on time. Parity is switched directly in the uart's control
+ * register while the line is idle, without reopening the serial port.
+ *
+ * The main loop only writes the head, the interrupt only the tail. A
+ * frame pushed while the line is free is loaded right away instead of
+ * waiting for the next tick. The transport overhead, the time from the
+ * frame and the line both being ready to the frame entering the uart,
+ * is measured with Timer2 in half microseconds.
+ */
+
+#ifndef TXRING_H
+#define TXRING_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifdef TX_RING
+
+#if TX_RING_SIZE > 128 || (TX_RING_SIZE & (TX_RING_SIZE - 1))
+#error "TX_RING_SIZE has to be a power of two, at most 128"
+#endif
+
+/**
+ * @brief Start the tick; the serial port has to be open already
+ */
+void txRingBegin();
+
+/**
+ * @return Number of frames the ring can still take
+ */
+uint8_t txRingFree();
+
+/**
+ * @return true once the ring is empty and the last frame has left the line
+ */
+bool txRingIdle();
+
+/**
+ * @brief Hand a frame to the transmitter
+ *
+ * @param flags FRAME_ODD_PARITY or 0
+ * @return false if the ring is full
+ */
+bool txRingPush(uint8_t code, uint8_t flags);
+
+/**
+ * @brief Copy the interrupt's counters into the stats
+ */
+void txRingStats();
+
+/**
+ * @brief Load the next frame once the line is free. Called by the Timer2
+ * interrupt.
+ */
+void txRingTick();
+
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file typematic.cpp
+ * @brief Keyboard typematic rate matched to what the MBC can absorb
+ */
+
+#include "typematic.h"
+
+uint8_t repeatCps = REPEAT_CPS;
+uint8_t repeatDelay = REPEAT_DELAY;
+
+#define REPEAT_CPS_MIN 2
+#define REPEAT_CPS_STEP 2
+
+uint8_t wireCapacityCps() {
+  return 1000000UL / (MBC_FRAME_US + MBC_FRAME_GAP_US);
+}
+
+/**
+ * The period of a rate code is (8 + A) * 2^B * 4.17ms, with A in bits
+ * 0-2 and B in bits 3-4: from 33ms (30 cps) up to 500ms (2 cps). The
+ * period is in units of 10us.
+ */
+static constexpr uint16_t typematicPeriodUs10(uint8_t rate) {
+  return (8 + (rate & 0x07)) * (1 << ((rate >> 3) & 0x03)) * 417;
+}
+
+// characters per second, rounded: 33.4ms is the keyboard's 30 cps
+static constexpr uint8_t periodCps(uint16_t periodUs10) {
+  return (100000UL + periodUs10 / 2) / periodUs10;
+}
+
+static_assert(periodCps(typematicPeriodUs10(0)) == 30, "rate 0 is 30 cps");
+static_assert(periodCps(typematicPeriodUs10(31)) == 2, "rate 31 is 2 cps");
+
+uint8_t typematicCps(uint8_t rate) {
+  return periodCps(typematicPeriodUs10(rate));
+}
+
+uint8_t typematicRate(uint8_t cps) {
+  if (cps > wireCapacityCps()) {
+    cps = wireCapacityCps();
+  }
+  // rates get slower with increasing code
+  for (uint8_t rate = 0; rate < 31; rate++) {
+    if (typematicCps(rate) <= cps) {
+      return rate;
+    }
+  }
+  return 31;
+}
+
+void repeatAdjust(bool faster) {
+  if (faster) {
+    if (repeatCps + REPEAT_CPS_STEP <= typematicCps(0)) {
+      repeatCps += REPEAT_CPS_STEP;
+    }
+  } else if (repeatCps >= REPEAT_CPS_MIN + REPEAT_CPS_STEP) {
+    repeatCps -= REPEAT_CPS_STEP;
+  }
+}
@@ -0,0 +1,69 @@
+/****************************************************************************/
+/* Sanyo MBC 550/555 keyboard adapter firmare                               */
+/*                                                                          */
+/* Copyright (C) 2024 Jochen Toppe                                          */
+/*                                                                          */
+/* This program is free software; you can redistribute it and/or            */
+/* modify it under the terms of the GNU Lesser General Public               */
+/* License as published by the Free Software Foundation; either             */
+/* version 3 of the License, or (at your option) any later version.         */
+/*                                                                          */
+/* This program is distributed in the hope that it will be useful,          */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of           */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        */
+/* Lesser General Public License for more details.                          */
+/*                                                                          */
+/* You should have received a copy of the GNU Lesser General Public License */
+/* along with this program; if not, write to the Free Software Foundation,  */
+/* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      */
+/****************************************************************************/
+
+/**
+ * @file typematic.h
+ * @brief Keyboard typematic rate matched to what the MBC can absorb
+ *
+ * Key repeat is left to the keyboard: the adapter sends the PS/2 Set
+ * Typematic Rate/Delay command (0xF3) at init and whenever the setting
+ * changes. The rate is the fastest one the keyboard supports that does
+ * not exceed the requested rate nor the capacity of the serial line,
+ * so repeats never build a backlog in the adapter.
+ *
+ * CTRL-ALT-= and CTRL-ALT-- change the requested rate.
+ */
+
+#ifndef TYPEMATIC_H
+#define TYPEMATIC_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// requested repeat, changed at runtime by the hotkeys
+extern uint8_t repeatCps;    // characters per second
+extern uint8_t repeatDelay;  // 0-3, i.e. 250, 500, 750 or 1000ms
+
+/**
+ * @return Frames per second the MBC line can carry
+ */
+uint8_t wireCapacityCps();
+
+/**
+ * @brief Typematic rate code for the PS/2 command
+ *
+ * @param cps Requested characters per second
+ * @return 0 (30 cps) to 31 (2 cps), the fastest rate not above cps
+ */
+uint8_t typematicRate(uint8_t cps);
+
+/**
+ * @return Characters per second of a typematic rate code
+ */
+uint8_t typematicCps(uint8_t rate);
+
+/**
+ * @brief Change the requested rate by a few characters per second
+ *
+ * @param faster true to speed up, false to slow down
+ */
+void repeatAdjust(bool faster);
+
+#endif